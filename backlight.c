@@ -0,0 +1,176 @@
+/*
+ * backlight.c
+ *
+ * Backlight PWM on TA0.1 with fades, auto-off and night dimming [see backlight.h].
+ */
+
+#include "backlight.h"
+
+#define BL_F_PWM			0x01				// CCR1 belongs to the backlight.
+#define BL_F_HIGH			0x02				// The output is high [toggle mode].
+#define BL_F_OFF			0x04				// Off until the next user input [timed out or switched off].
+#define BL_F_NIGHT			0x08				// The last time reported was at night.
+
+// #########################
+// Global Variables
+static volatile uint8_t		bl_cur;				// Level being output.
+static volatile uint8_t		bl_target;			// Level being faded to.
+static volatile uint8_t		bl_flags;			// BL_F_xxx
+static volatile uint16_t	bl_on;				// High time in ticks; picked up at the next edge.
+static uint8_t				bl_fade_ms;
+static uint8_t				bl_idle;			// Seconds since the last user input.
+
+// #########################
+// Function Definitions
+
+// Output for bl_cur.  Called from the systick or with interrupts off.
+static void bl_apply(void)
+{
+	uint16_t on = (uint16_t)bl_cur << BL_PWM_SHIFT;
+
+	if ( (on != 0) && (on < BL_PWM_MIN_TICKS) )
+		on = BL_PWM_MIN_TICKS;
+	else if (on > BL_PWM_PERIOD - BL_PWM_MIN_TICKS)
+		on = BL_PWM_PERIOD;
+	bl_on = on;
+
+	if ( (on == 0) || (on == BL_PWM_PERIOD) )
+	{
+		BL_PWM_CCTL = OUTMOD_0 | ((on) ? OUT : 0);		// Steady; no interrupts.
+		bl_flags &= ~BL_F_HIGH;
+	}
+	else if ( (BL_PWM_CCTL & CCIE) == 0 )
+	{
+		BL_PWM_CCTL = OUTMOD_0;							// Start toggling from low.
+		bl_flags &= ~BL_F_HIGH;
+		BL_PWM_CCR = TA0R + BL_PWM_MIN_TICKS;
+		BL_PWM_CCTL = OUTMOD_4 | CCIE;
+	}
+}
+
+static inline uint8_t bl_on_level(void)
+{
+	return (bl_flags & BL_F_NIGHT) ? BL_LEVEL_NIGHT : BL_LEVEL_DAY;
+}
+
+// P1.2 as TA0.1, output low until bl_start().
+void bl_init(void)
+{
+	P1OUT &= ~BL_PWM_PIN;
+	P1DIR |= BL_PWM_PIN;
+	P1SEL |= BL_PWM_PIN;
+	bl_target = bl_on_level();
+}
+
+/*
+ * Takes CCR1 over from the LCD init and starts the output at the current level.
+ * Returns 1 if the PWM is running, 0 if CCR1 is still timing an init delay [try again later].
+ */
+int bl_start(void)
+{
+	uint16_t intState;
+
+	if (bl_flags & BL_F_PWM)
+		return 1;
+	intState = __get_interrupt_state();
+	__disable_interrupt();
+	if ( (BL_PWM_CCTL & CCIE) == 0 )
+	{
+		bl_flags |= BL_F_PWM;
+		bl_apply();
+	}
+	__set_interrupt_state(intState);
+	return ( (bl_flags & BL_F_PWM) != 0 );
+}
+
+// 1 once CCR1 belongs to the backlight; the TIMER0_A1 ISR sends CCR1 matches to bl_pwm_tick() from then on.
+int bl_pwm_active(void)
+{
+	return ( (bl_flags & BL_F_PWM) != 0 );
+}
+
+void bl_fade_to(uint8_t level)
+{
+	bl_target = level;
+}
+
+uint8_t bl_level(void)
+{
+	return bl_cur;
+}
+
+// 1 when the backlight has faded out and is staying out; the display can be switched off.
+int bl_dark(void)
+{
+	return ( (bl_cur == 0) && (bl_target == 0) );
+}
+
+/*
+ * User input; restarts the timeout and brings the backlight back if it was off.
+ * Returns 1 if it was off [the display may need bringing up to date].
+ */
+int bl_activity(void)
+{
+	int wasOff = (bl_flags & BL_F_OFF) != 0;
+
+	bl_idle = 0;
+	bl_flags &= ~BL_F_OFF;
+	bl_target = bl_on_level();
+	return wasOff;
+}
+
+// The backlight button: off until the next input, or back on.
+void bl_toggle(void)
+{
+	if (bl_flags & BL_F_OFF)
+		bl_activity();
+	else
+	{
+		bl_flags |= BL_F_OFF;
+		bl_target = 0;
+	}
+}
+
+/*
+ * Once a second with the hour [0-23]: counts towards the timeout and follows night dimming.
+ */
+void bl_second(uint8_t hour)
+{
+	if ( (hour >= BL_NIGHT_FROM) || (hour < BL_NIGHT_TO) )
+		bl_flags |= BL_F_NIGHT;
+	else
+		bl_flags &= ~BL_F_NIGHT;
+
+#if BL_TIMEOUT_S > 0
+	if ( (bl_idle < BL_TIMEOUT_S) && (++bl_idle == BL_TIMEOUT_S) )
+		bl_flags |= BL_F_OFF;
+#endif
+	bl_target = (bl_flags & BL_F_OFF) ? 0 : bl_on_level();
+}
+
+/*
+ * Call from the systick [1ms]; steps a fade.
+ * Returns non-zero when a fade out has just reached 0 and main() should be woken to switch the display off.
+ */
+int bl_tick(void)
+{
+	if ( !(bl_flags & BL_F_PWM) || (bl_cur == bl_target) )
+		return 0;
+	if (++bl_fade_ms < BL_FADE_STEP_MS)
+		return 0;
+	bl_fade_ms = 0;
+	bl_cur += (bl_target > bl_cur) ? 1 : -1;
+	bl_apply();
+	return (bl_cur == 0);
+}
+
+/*
+ * TA0.1 CCR1 handler; call from the TIMER0_A1 ISR once bl_pwm_active().
+ * The output has just toggled in hardware; sets up the next edge.
+ */
+int bl_pwm_tick(void)
+{
+	bl_flags ^= BL_F_HIGH;
+	BL_PWM_CCR += (bl_flags & BL_F_HIGH) ? bl_on : (BL_PWM_PERIOD - bl_on);
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * backlight.h
+ *
+ * LCD backlight dimming with auto-off and night dimming.
+ *
+ * The backlight LED is switched by TA0.1 [P1.2].  Timer_A0 stays in continuous mode for the systick, the LCD init
+ * delays and the I2C watchdog, so the PWM runs CCR1 in toggle mode and the CCR1 interrupt schedules the next edge;
+ * the edges themselves are hardware timed.  0% and 100% are steady outputs with no interrupts.
+ * CCR1 is shared with the LCD init delays [LCD_INIT_CCR]: bl_start() only takes it once the init has finished.
+ *
+ * Level changes fade one step every BL_FADE_STEP_MS from bl_tick() [the systick].  The application reports user
+ * input [bl_activity()] and the time once a second [bl_second()]; the backlight fades out BL_TIMEOUT_S after the
+ * last input and runs at BL_LEVEL_NIGHT between BL_NIGHT_FROM and BL_NIGHT_TO.  Once it has faded to 0 [bl_dark()]
+ * the application can turn the display itself off.
+ */
+
+#ifndef BACKLIGHT_H_
+#define BACKLIGHT_H_
+
+#include <msp430.h>
+#include <stdint.h>
+
+#define BL_PWM_PIN			BIT2				// P1.2 = TA0.1
+#define BL_PWM_CCR			TA0CCR1
+#define BL_PWM_CCTL			TA0CCTL1
+#define BL_LEVEL_MAX		255
+#define BL_PWM_SHIFT		6					// Ticks per level; the period is 255 x 64 = 16320 ticks [~980Hz at 16MHz].
+#define BL_PWM_PERIOD		((uint16_t)BL_LEVEL_MAX << BL_PWM_SHIFT)
+#define BL_PWM_MIN_TICKS	256u				// Shortest high or low time; the CCR1 interrupt has to set up the next edge before it's due.
+
+#define BL_FADE_STEP_MS		4					// Full fade ~1s.
+#define BL_TIMEOUT_S		120					// Seconds without user input before fading out; 0 never, at most 254.
+#define BL_LEVEL_DAY		BL_LEVEL_MAX
+#define BL_LEVEL_NIGHT		40
+#define BL_NIGHT_FROM		22					// Hours [24h] of night dimming.
+#define BL_NIGHT_TO			7
+
+// Provided functions.
+void bl_init(void);
+int bl_start(void);
+int bl_pwm_active(void);
+void bl_fade_to(uint8_t level);
+uint8_t bl_level(void);
+int bl_dark(void);
+int bl_activity(void);
+void bl_toggle(void);
+void bl_second(uint8_t hour);
+int bl_tick(void);
+int bl_pwm_tick(void);
+
+#endif /* BACKLIGHT_H_ */
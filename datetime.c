@@ -91,3 +91,33 @@ uint8_t days_in_month(DateTime_t *pdt)
 
 	return (daysInMonths[month] + adjust);
 }
+
+// Steps one field in its own format; past 'last' [decimal] it goes back to 'first'.  Returns 1 on the wrap.
+static uint8_t step_field(uint8_t *pField, uint8_t first, uint8_t last, uint8_t bcd)
+{
+	uint8_t val = (bcd) ? bcdToDec8(*pField) : *pField;
+	uint8_t wrap = (val >= last);
+
+	val = (wrap) ? first : (val + 1);
+	*pField = (bcd) ? decToBcd8(val) : val;
+	return wrap;
+}
+
+/* *********
+* Advances the date and time by one second, carrying through the minutes, hours, day of the week, day of the month
+* [days_in_month()], month and year; keeps the time between RTC reads from the RTC's 1Hz output.
+* Works in either format [bcd_format].
+* Returns 1 if the date moved on [midnight], 0 otherwise.
+********* */
+uint8_t datetime_tick(DateTime_t *pdt)
+{
+	uint8_t bcd = pdt->bcd_format;
+
+	if ( !step_field(&pdt->seconds, 0, 59, bcd) || !step_field(&pdt->minutes, 0, 59, bcd) ||
+		 !step_field(&pdt->hours, 0, 23, bcd) )
+		return 0;
+	step_field(&pdt->dow, 1, 7, bcd);
+	if ( step_field(&pdt->dom, 1, days_in_month(pdt), bcd) && step_field(&pdt->month, 1, 12, bcd) )
+		step_field(&pdt->year, 0, 99, bcd);
+	return 1;
+}
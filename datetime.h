@@ -32,5 +32,9 @@ typedef struct _DateTime_t
 
 
 // Provided functions:
+int is_leap_year(DateTime_t *pdt);
+int is_dst(DateTime_t *pdt);
+uint8_t days_in_month(DateTime_t *pdt);
+uint8_t datetime_tick(DateTime_t *pdt);
 
 #endif /* DATETIME_H_ */
@@ -6,93 +6,71 @@
  */
 
 
+#include <string.h>
 #include "ds3231m_lib.h"
 
 // Internal functions.
-static void reset_addr_ptr_to_start(i2c_transaction_t* i2c_trn)
+static inline uint8_t ds3231m_set_regs(i2c_transaction_t* i2c_trn, uint8_t startReg, uint8_t numRegs)
 {
-	// Set the ds3231m register pointer back to the start.
+	// The i2c buffer must be set by caller, and the data as well.
+	(void)startReg;												// Goes in buf[0], ahead of the data.
 	i2c_trn->address = RTC_ADDR;
+	i2c_trn->clkDiv = RTC_I2C_CLK_DIV;
+	i2c_trn->numBytes = numRegs;
 	i2c_trn->transactType = I2C_T_TX_STOP;
-	i2c_trn->buf[0] = RTC_SEC;
-	i2c_trn->numBytes = 1;
-	usi_i2c_txrx_start(i2c_trn);
-	//usi_i2c_sleep_wait(1);
-
-}
-
-static inline uint8_t ds3231m_get_regs(i2c_transaction_t* i2c_trn, uint8_t startReg, uint8_t numRegs)
-{
-	// The i2c buffer must be set by the caller.
-	if (startReg == RTC_SEC)
-	{
-		i2c_trn->address = RTC_ADDR | I2C_READ_BIT;
-		i2c_trn->numBytes = numRegs;
-		i2c_trn->transactType = I2C_T_RX_STOP;
-	}
-	else
-	{
-
-	}
-
 	return 0;
 }
 
-static inline uint8_t ds3231m_set_regs(i2c_transaction_t* i2c_trn, uint8_t startReg, uint8_t numRegs)
+
+// Public functions.
+/*
+ * Sets up a read of numRegs registers from startReg as one random read transaction;
+ * the register pointer is written every time so it doesn't matter where the last access left it.
+ * The i2c buffer must be set by the caller and hold numRegs bytes.  The caller starts the transaction.
+ */
+uint8_t ds3231m_get_regs(i2c_transaction_t* i2c_trn, uint8_t startReg, uint8_t numRegs)
 {
-	// The i2c buffer must be set by caller, and the data as well.
 	i2c_trn->address = RTC_ADDR;
+	i2c_trn->clkDiv = RTC_I2C_CLK_DIV;
+	i2c_trn->buf[0] = startReg;
 	i2c_trn->numBytes = numRegs;
-	i2c_trn->transactType = I2C_T_TX_STOP;
+	i2c_trn->transactType = I2C_T_RX_RNDM;
+
 	return 0;
 }
 
-
-// Public functions.
+/*
+ * Blocking RTC setup: control and status to 0 [oscillator on, no square wave or alarm interrupts, flags cleared].
+ * Both are read in one transaction and only written if they aren't 0 already, so a warm restart is a single read.
+ * Returns the status register as it was; 0 if it couldn't be read.
+ */
 uint8_t ds3231m_init(i2c_transaction_t* i2c_trn, volatile uint8_t* buf)
 {
-	uint8_t status;
-
-	// Get the status register.
-	i2c_trn->buf = buf;
-	i2c_trn->address = RTC_ADDR | I2C_READ_BIT;
-	i2c_trn->buf[0] = RTC_STATUS;
-	i2c_trn->transactType = I2C_T_TX_RESTART;
-	i2c_trn->numBytes = 1;
-	usi_i2c_txrx_start(i2c_trn);
-	usi_i2c_sleep_wait(1);
-	i2c_trn->buf = buf;
-	i2c_trn->address = RTC_ADDR;
-	i2c_trn->transactType = I2C_T_RX_STOP;
-	i2c_trn->numBytes = 1;
-	usi_i2c_txrx_resume();
-	usi_i2c_sleep_wait(1);
-	status = buf[0];
+	uint8_t status = 0;
+	uint8_t write = 1;									// Not read; the write still goes out.
 
-	// Set up the RTC and clear all flags.
 	i2c_trn->buf = buf;
-	i2c_trn->address = RTC_ADDR;
-	i2c_trn->transactType = I2C_T_TX_STOP;
-	i2c_trn->buf[0] = RTC_CONTROL;
-	i2c_trn->buf[1] = 0x00;
-	i2c_trn->buf[2] = 0x00;
-	i2c_trn->numBytes = 3;
+	ds3231m_get_regs(i2c_trn, RTC_CONTROL, 2);
 	usi_i2c_txrx_start(i2c_trn);
 	usi_i2c_sleep_wait(1);
+	if (usi_i2c_get_error() == USI_I2C_ERR_NONE)
+	{
+		status = buf[1];
+		write = buf[0] | status;
+	}
 
-	// Set the ds3231m register pointer back to the start.
-	i2c_trn->buf = buf;
-	reset_addr_ptr_to_start(i2c_trn);
-	usi_i2c_sleep_wait(1);
-	/*i2c_trn->address = RTC_ADDR;
-	i2c_trn->transactType = I2C_T_TX_STOP;
-	i2c_trn->buf[0] = RTC_SEC;
-	i2c_trn->numBytes = 1;
-	usi_i2c_txrx_start(i2c_trn);
-	usi_i2c_sleep_wait(1);*/
-
+	if (write)
+	{
+		i2c_trn->buf = buf;
+		buf[0] = RTC_CONTROL;
+		buf[1] = 0x00;
+		buf[2] = 0x00;
+		ds3231m_set_regs(i2c_trn, RTC_CONTROL, 3);
+		usi_i2c_txrx_start(i2c_trn);
+		usi_i2c_sleep_wait(1);
+	}
+	i2c_trn->transactType = I2C_T_IDLE;
 
-	// Return the contents of the status register.
 	return status;
 }
 
@@ -126,13 +104,13 @@ Format the entries as per the keepBcd variable [keepBcd > 0 implies retain BCD f
 */
 void convert_array_to_datetime(uint8_t* msgBuf, DateTime_t* dt, uint8_t keepBcd)
 {
-	dt->seconds = msgBuf[0] & 0x7f;
-	dt->minutes = msgBuf[1] & 0x7f;
-	dt->hours = msgBuf[2] & 0x3f;	//Using 24hr time format.
-	dt->dow = msgBuf[3] & 0x07;
-	dt->dom = msgBuf[4] & 0x3f;
-	dt->month = msgBuf[5] & 0x1f;
-	dt->year = msgBuf[6];
+	// Register bits that hold the value; 24hr time format, century bit dropped from the month.
+	static const uint8_t masks[7] = { 0x7f, 0x7f, 0x3f, 0x07, 0x3f, 0x1f, 0xff };
+	uint8_t* field = &dt->seconds;
+	uint8_t n;
+
+	for (n = 0; n < 7; n++)
+		field[n] = msgBuf[n] & masks[n];
 	dt->bcd_format = 1;
 
 	if (keepBcd == 0)
@@ -145,41 +123,32 @@ void convert_array_to_datetime(uint8_t* msgBuf, DateTime_t* dt, uint8_t keepBcd)
 void convert_datetime_to_array(uint8_t* buf, DateTime_t* pdt)
 {
 	//buf[0] = RTC_SEC;
-	buf[0] = pdt->seconds;
-	buf[1] = pdt->minutes;
-	buf[2] = pdt->hours;
-	buf[3] = pdt->dow;
-	buf[4] = pdt->dom;
-	buf[5] = pdt->month;
-	buf[6] = pdt->year;
+	memcpy(buf, &pdt->seconds, 7);
 }
 
+// The seven fields from seconds to year are consecutive bytes, in the RTC's register order; converted in a loop.
 void convert_datetime_to_decimal(DateTime_t* dt)
 {
+	uint8_t* field = &dt->seconds;
+	uint8_t n;
+
 	if (dt->bcd_format)
 	{
-		dt->seconds = bcdToDec8(dt->seconds);
-		dt->minutes = bcdToDec8(dt->minutes);
-		dt->hours = bcdToDec8(dt->hours);
-		dt->dow = bcdToDec8(dt->dow);
-		dt->dom = bcdToDec8(dt->dom);
-		dt->month = bcdToDec8(dt->month);
-		dt->year = bcdToDec8(dt->year);
+		for (n = 0; n < 7; n++)
+			field[n] = bcdToDec8(field[n]);
 		dt->bcd_format = 0;
 	}
 }
 
 void convert_datetime_to_bcd(DateTime_t* dt)
 {
+	uint8_t* field = &dt->seconds;
+	uint8_t n;
+
 	if (dt->bcd_format == 0)
 	{
-		dt->seconds = decToBcd8(dt->seconds);
-		dt->minutes = decToBcd8(dt->minutes);
-		dt->hours = decToBcd8(dt->hours);
-		dt->dow = decToBcd8(dt->dow);
-		dt->dom = decToBcd8(dt->dom);
-		dt->month = decToBcd8(dt->month);
-		dt->year = decToBcd8(dt->year);
+		for (n = 0; n < 7; n++)
+			field[n] = decToBcd8(field[n]);
 		dt->bcd_format = 1;
 	}
 }
@@ -191,38 +160,12 @@ void ds3231m_set_time(DateTime_t* pdt, i2c_transaction_t* pi2ct)
 		convert_datetime_to_bcd(pdt);
 	}
 
-	convert_datetime_to_array(pi2ct->buf, pdt);
+	pi2ct->buf[0] = RTC_SEC;				// Register pointer, then the 7 time registers.
+	convert_datetime_to_array((uint8_t *)&pi2ct->buf[1], pdt);
 
 	pi2ct->address = RTC_ADDR;
+	pi2ct->clkDiv = RTC_I2C_CLK_DIV;
 	pi2ct->numBytes = 8;
 	pi2ct->transactType = I2C_T_TX_STOP;
 	//Caller can now start the i2c_transaction.
 }
-
-void ds3231m_set_time_dbg(DateTime_t* pdt, i2c_transaction_t* pi2ct)
-{
-	DateTime_t dt = {0x15, 0x45, 0x01, 0x02, 0x14, 0x02, 0x05, 0x01};	// Monday, 14-Feb-2005, 01:45:15, BCD format.
-	volatile uint8_t* bufptr = pi2ct->buf;
-	if (pdt == NULL)
-		pdt = &dt;
-
-	pi2ct->buf[0] = RTC_SEC;
-	pi2ct->buf[1] = pdt->seconds;
-	pi2ct->buf[2] = pdt->minutes;
-	pi2ct->buf[3] = pdt->hours;
-	pi2ct->buf[4] = pdt->dow;
-	pi2ct->buf[5] = pdt->dom;
-	pi2ct->buf[6] = pdt->month;
-	pi2ct->buf[7] = pdt->year;
-
-	ds3231m_set_regs(pi2ct, RTC_SEC, 8);
-	usi_i2c_txrx_start(pi2ct);
-	usi_i2c_sleep_wait(1);
-
-	// Set the ds3231m register pointer back to the start.
-	pi2ct->buf = bufptr;
-	reset_addr_ptr_to_start(pi2ct);
-	usi_i2c_sleep_wait(1);
-
-	pi2ct->transactType = I2C_T_IDLE;
-}
@@ -14,6 +14,7 @@
 
 
 #define RTC_ADDR		0xd0 //Maxim DS3231M+ RTC I2C Slave address.
+#define RTC_I2C_CLK_DIV	USIDIV_6	// 250kHz SCL at 16MHz; the DS3231M is a 400kHz part.
 // Defines for Maxim DS3231M+ clock registers.
 #define RTC_SEC					0x00
 #define RTC_MIN					0x01
@@ -65,6 +66,7 @@ uint8_t rtc_set_control(uint8_t *msgBuf, uint8_t regVal);
 uint8_t rtc_enable_alarm1(uint8_t *msgBuf);
 uint8_t rtc_enable_alarm2(uint8_t *msgBuf);*/
 uint8_t ds3231m_init(i2c_transaction_t* i2c_trn, volatile uint8_t* buf);
+uint8_t ds3231m_get_regs(i2c_transaction_t* i2c_trn, uint8_t startReg, uint8_t numRegs);
 uint8_t ds3231m_get_time(i2c_transaction_t* i2c_trn);
 uint8_t ds3231m_get_all(i2c_transaction_t* i2c_trn);
 void convert_array_to_datetime(uint8_t* msgBuf, DateTime_t* dt, uint8_t keepBcd);
@@ -72,11 +74,7 @@ void convert_datetime_to_array(uint8_t* buf, DateTime_t* pdt);
 void convert_datetime_to_decimal(DateTime_t* dt);
 void convert_datetime_to_bcd(DateTime_t* dt);
 void ds3231m_set_time(DateTime_t* pdt, i2c_transaction_t* pi2ct);
-uint8_t rtc_get_temperature(uint8_t *msgBuf);
 uint8_t decToBcd8(uint8_t val);
 uint8_t bcdToDec8(uint8_t val);
 
-//Debug functions
-void ds3231m_set_time_dbg(DateTime_t* pdt, i2c_transaction_t *pi2ct);
-
 #endif /* DS3231M_LIB_H_ */
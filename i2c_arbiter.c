@@ -0,0 +1,81 @@
+/*
+ * i2c_arbiter.c
+ *
+ * Priority arbiter for the main() I2C jobs [see i2c_arbiter.h].
+ * Requests are level style: main() passes a bit per client that has work each pass, the same way the
+ * flags used to be tested, and the highest priority one gets the bus whenever the USI is free.
+ */
+
+#include "i2c_arbiter.h"
+
+// #########################
+// Global Variables
+static uint16_t				arb_seen;				// Clients that were waiting at the last dispatch.
+static uint8_t				arb_owner = I2C_ARB_NONE;	// Client whose job has the bus.
+static uint8_t				arb_parked = I2C_ARB_NONE;	// Client whose job gave way at a transaction boundary.
+static i2c_callback_fnptr_t	arb_parked_fn;			// Where the parked job carries on.
+
+// #########################
+// Function Definitions
+
+/*
+ * Call every main() pass with a bit set for each client that has work [bit n = gI2cArbClients[n]].
+ * If the USI is free, starts [or resumes] the highest priority client's job.
+ * Returns the client started, or I2C_ARB_NONE.
+ */
+uint8_t i2c_arb_dispatch(i2c_transaction_t *trn, uint16_t ready)
+{
+	uint8_t client;
+	uint16_t want;
+	i2c_callback_fnptr_t next;
+
+	arb_seen = ready;
+	if (usi_i2c_busy())
+		return I2C_ARB_NONE;
+
+	arb_owner = I2C_ARB_NONE;						// Whoever had the bus has finished or parked.
+	want = ready;
+	if (arb_parked != I2C_ARB_NONE)
+		want |= 1u << arb_parked;
+	if (want == 0)
+		return I2C_ARB_NONE;
+
+	for (client = 0; (want & (1u << client)) == 0; client++);
+	arb_owner = client;
+	if (client == arb_parked)
+	{
+		next = arb_parked_fn;
+		arb_parked = I2C_ARB_NONE;
+		usi_i2c_get();								// The job let go of the USI when it parked.
+		next(trn, NULL);
+	}
+	else
+		gI2cArbClients[client].job(trn, NULL);
+	return client;
+}
+
+/*
+ * Transaction boundary in a multi-transaction job; 'next' is where the job would carry on.
+ * Returns 1 if a higher priority client or a posted transaction is waiting; the job is parked and the caller
+ * must release the USI [and anything else it holds] and leave callbackFn NULL.  'next' is called once the
+ * bus comes back to this client.  Returns 0 if the job should carry straight on.
+ * Only one job can be parked; jobs not started by i2c_arb_dispatch() are never parked.
+ */
+int i2c_arb_yield(i2c_callback_fnptr_t next)
+{
+	if ( (arb_owner == I2C_ARB_NONE) || (arb_parked != I2C_ARB_NONE) )
+		return 0;
+	if ( ((arb_seen & ((1u << arb_owner) - 1)) == 0) && (usi_i2c_post_pending() == 0) )
+		return 0;
+
+	arb_parked = arb_owner;
+	arb_parked_fn = next;
+	arb_owner = I2C_ARB_NONE;
+	return 1;
+}
+
+// Client whose job has the bus, or I2C_ARB_NONE.
+uint8_t i2c_arb_owner(void)
+{
+	return arb_owner;
+}
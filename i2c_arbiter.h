@@ -0,0 +1,38 @@
+/*
+ * i2c_arbiter.h
+ *
+ * Hands the I2C bus to main() jobs in priority order.
+ *
+ * A client is a job that takes the USI [usi_i2c_get()], runs one or more transactions chained through the
+ * transaction's callbackFn and finally releases the USI.  Clients are listed in the application's
+ * gI2cArbClients[] table in priority order; index 0 is the highest.
+ * A multi-transaction job can call i2c_arb_yield() between its transactions; if higher priority work is
+ * waiting [or a posted transaction is] the job is parked there and resumed once the bus comes back to it.
+ */
+
+#ifndef I2C_ARBITER_H_
+#define I2C_ARBITER_H_
+
+#include <stdint.h>
+#include "msp430_usi_i2c_int.h"
+
+#define I2C_ARB_NUM_CLIENTS		5		// Entries in gI2cArbClients[]; at most 16 [bits of the ready mask].
+#define I2C_ARB_NONE			0xff
+#if I2C_ARB_NUM_CLIENTS > 16
+#error "The arbiter's ready mask has a bit per client; at most 16."
+#endif
+
+typedef struct _i2c_arb_client_t
+{
+	i2c_callback_fnptr_t	job;		// Started as job(trn, NULL) when the client gets the bus.
+} i2c_arb_client_t;
+
+// Provided by the application.
+extern const i2c_arb_client_t gI2cArbClients[I2C_ARB_NUM_CLIENTS];
+
+// Provided functions.
+uint8_t i2c_arb_dispatch(i2c_transaction_t *trn, uint16_t ready);
+int i2c_arb_yield(i2c_callback_fnptr_t next);
+uint8_t i2c_arb_owner(void);
+
+#endif /* I2C_ARBITER_H_ */
@@ -7,9 +7,49 @@
 
 #include "lcd.h"
 
+// Asynchronous init steps.
+#define LCD_INIT_S_PROBE	0
+#define LCD_INIT_S_EXPANDER	1
+#define LCD_INIT_S_CMDS		2
+
+#define LCD_PIN_MASK	((1 << BACKLIGHT_PORT) | (1 << DB7_PORT) | (1 << DB6_PORT) | (1 << DB5_PORT) | (1 << DB4_PORT) | (1 << RS_PORT))	//0xfa
+#define LCD_CTRL_REST	(((lcd_info.states & LCD_BACKLIGHT_STATE) << BACKLIGHT_PORT))	// RS, R/W and E low.
+
 //Globals
 static lcd_sys_info_t lcd_info;
-
+static volatile uint8_t *lcd_init_buf;				// Asynchronous init in progress if not NULL.
+static uint8_t lcd_init_step;						// LCD_INIT_S_xxx, then LCD_INIT_S_CMDS + index into lcd_init_cmds[].
+static volatile uint16_t lcd_init_left;				// us of the current init delay still to time after this chunk.
+
+
+// HD44780 power on sequence, with the delay [us] that follows each command.
+// The first LCD_INIT_8BIT_CMDS are sent as single 8-bit transfers [one nibble].
+#define LCD_INIT_CMDS		10
+#define LCD_INIT_8BIT_CMDS	4
+#define LCD_INIT_CMD_FULL(cmd)	((cmd) >= LCD_INIT_8BIT_CMDS)	// Two nibbles, once in 4-bit mode.
+static const uint8_t lcd_init_cmds[LCD_INIT_CMDS] = {	0x30,	// init
+														0x30,	// init
+														0x30,	// init; display now reset.
+														0x20,	// Put display in 4-bit mode [sent in 8-bit mode]
+														0x28,	// 4-bit mode, #lines=2, 5x8dot format.
+														0x08,	// Display off, cursor off, blinking off.
+														0x01,	// Clear display.
+														0x06,	// Set entry mode, cursor move, no display shift.
+														0x02,	// Return home.
+														0x0c	// Display on + no display cursor + no blinking on.
+														//0x0f	// Display on + display cursor + blinking on.
+};
+static const uint16_t lcd_init_delays[LCD_INIT_CMDS] = {	LCD_INIT_DELAY_1/DELAY_1US,
+															LCD_INIT_DELAY_2/DELAY_1US,
+															LCD_INIT_DELAY_2/DELAY_1US,
+															LCD_STD_CMD_DELAY/DELAY_1US,
+															LCD_STD_CMD_DELAY/DELAY_1US,
+															LCD_STD_CMD_DELAY/DELAY_1US,
+															LCD_CLEAR_DELAY/DELAY_1US,
+															LCD_STD_CMD_DELAY/DELAY_1US,
+															LCD_HOME_DELAY/DELAY_1US,
+															LCD_STD_CMD_DELAY/DELAY_1US
+};
 
 //Function Prototypes
 static int send_lcd_cmd_int(uint8_t val, i2c_transaction_t *i2c_trans);
@@ -22,6 +62,19 @@ static inline void delay_us(uint16_t count)
 		__delay_cycles(16);
 }
 
+/*
+Expander byte for one phase of a 4-bit transfer [see lcd_write_int()].
+phase:	0 = upper nibble + E high, 1 = upper nibble + E low, 2 = lower nibble + E high, 3 = lower nibble + E low.
+*/
+static inline uint8_t lcd_encode_phase(uint8_t val, uint8_t phase, uint8_t rs)
+{
+	uint8_t temp;
+
+	temp = (phase & 0x02) ? ((val & 0x0f) << DB4_PORT) : ((val & 0xf0) >> (7 - DB7_PORT));
+	temp = (temp | (rs << RS_PORT) | ((lcd_info.states & LCD_BACKLIGHT_STATE) << BACKLIGHT_PORT)) & LCD_PIN_MASK;
+	return (phase & 0x01) ? temp : (temp | (1 << E_PORT));
+}
+
 int lcd_busy(void)
 {
 	return ( (lcd_info.states & LCD_BUSY) != 0 );
@@ -54,13 +107,33 @@ int lcd_check_event(void)
 	return (0 != (lcd_info.flags & LCD_BUSY));
 }
 
-int lcd_check_io_expander_no_init_int(i2c_transaction_t * i2c_trn, volatile uint8_t *buf)
+// Expander probe: reads IODIR, which is 0xff after the expander powers up.
+static inline void prep_expander_probe(i2c_transaction_t * i2c_trn, volatile uint8_t *buf)
 {
 	i2c_trn->address = (IO_EXPANDER_ADDR | 0x01);
+	i2c_trn->clkDiv = LCD_I2C_CLK_DIV;
 	i2c_trn->numBytes = 1;
-	i2c_trn->callbackFn = NULL;
 	i2c_trn->transactType = I2C_T_RX_STOP;
 	i2c_trn->buf = buf;
+}
+
+// Expander setup: all pins outputs, sequential addressing off; the registers from IODIR up to IOCON are written.
+static inline void prep_expander_init(i2c_transaction_t * i2c_trn, volatile uint8_t *buf)
+{
+	i2c_trn->address = IO_EXPANDER_ADDR;
+	i2c_trn->clkDiv = LCD_I2C_CLK_DIV;
+	i2c_trn->numBytes = IO_EXP_CONF_REG + 2;
+	i2c_trn->transactType = I2C_T_TX_STOP;
+	i2c_trn->buf = buf;
+	memset((uint8_t *)i2c_trn->buf, 0, IO_EXP_CONF_REG + 1);		// Make sure the buffer is zeroed.
+
+	i2c_trn->buf[IO_EXP_CONF_REG + 1] = IO_EXP_IOCON;
+}
+
+int lcd_check_io_expander_no_init_int(i2c_transaction_t * i2c_trn, volatile uint8_t *buf)
+{
+	prep_expander_probe(i2c_trn, buf);
+	i2c_trn->callbackFn = NULL;
 
 	usi_i2c_txrx_start(i2c_trn);
 	usi_i2c_sleep_wait(1);
@@ -73,14 +146,8 @@ int lcd_check_io_expander_no_init_int(i2c_transaction_t * i2c_trn, volatile uint
 
 void lcd_io_expander_init_int(i2c_transaction_t * i2c_trn, volatile uint8_t *buf)
 {
-	i2c_trn->address = IO_EXPANDER_ADDR;
-	i2c_trn->numBytes = 7;
+	prep_expander_init(i2c_trn, buf);
 	i2c_trn->callbackFn = NULL;
-	i2c_trn->transactType = I2C_T_TX_STOP;
-	i2c_trn->buf = buf;
-	memset((uint8_t *)i2c_trn->buf, 0, 6);							// Make sure the buffer is zeroed.
-
-	i2c_trn->buf[6] = 0x20;
 
 	usi_i2c_txrx_start(i2c_trn);
 	usi_i2c_sleep_wait(1);
@@ -88,39 +155,17 @@ void lcd_io_expander_init_int(i2c_transaction_t * i2c_trn, volatile uint8_t *buf
 	i2c_trn->transactType = I2C_T_IDLE;
 }
 
+/*
+Blocking HD44780 init; spins through the delays.  See lcd_init_async_start() for the version that sleeps.
+*/
 void lcd_init_int(i2c_transaction_t * i2c_trn, volatile uint8_t *buf)
 {
-	const uint16_t delays[] = {	LCD_INIT_DELAY_1/16,
-								LCD_INIT_DELAY_2/16,
-								LCD_INIT_DELAY_2/16,
-								LCD_STD_CMD_DELAY/16,
-								LCD_STD_CMD_DELAY/16,
-								LCD_STD_CMD_DELAY/16,
-								LCD_CLEAR_DELAY/16,
-								LCD_STD_CMD_DELAY/16,
-								LCD_HOME_DELAY/16,
-								LCD_STD_CMD_DELAY/16
-	};
-
-	const uint8_t cmds[] = {	0x30,	// init
-								0x30,	// init
-								0x30,	// init; display now reset.
-								0x20,	// Put display in 4-bit mode [sent in 8-bit mode]
-								0x28,	// 4-bit mode, #lines=2, 5x8dot format.
-								0x08,	// Display off, cursor off, blinking off.
-								0x01,	// Clear display.
-								0x06,	// Set entry mode, cursor move, no display shift.
-								0x02,	// Return home.
-								0x0c	// Display on + no display cursor + no blinking on.
-								//0x0f	// Display on + display cursor + blinking on.
-	};
-
-	uint8_t i, cmdIndx, dlyIndx; //, tmp;
+	uint8_t i, cmdIndx;
 
 	cmdIndx = 0;
-	dlyIndx = 0;
 
 	i2c_trn->address = IO_EXPANDER_ADDR;
+	i2c_trn->clkDiv = LCD_I2C_CLK_DIV;
 	i2c_trn->numBytes = 1;
 	i2c_trn->buf = buf;
 	i2c_trn->transactType = I2C_T_TX_WAIT;
@@ -131,31 +176,160 @@ void lcd_init_int(i2c_transaction_t * i2c_trn, volatile uint8_t *buf)
 	usi_i2c_sleep_wait(1);
 
 	// Initialization where interface is still in 8-bit mode...
-	for (i = 4; i > 0; i--)
+	for (i = LCD_INIT_8BIT_CMDS; i > 0; i--)
 	{
 		i2c_trn->buf = buf;
-		lcd_write_int(cmds[cmdIndx++], 0, 0, buf);
+		lcd_write_int(lcd_init_cmds[cmdIndx], 0, 0, buf);
 		i2c_trn->numBytes = 2;
 		usi_i2c_txrx_resume();
 		usi_i2c_sleep_wait(1);
-		delay_us(delays[dlyIndx++]);
+		delay_us(lcd_init_delays[cmdIndx++]);
 	}
 
 	// Initialization where interface is now in 4-bit mode...
-	for (i = 6; i > 0; i--)
+	for (i = LCD_INIT_CMDS - LCD_INIT_8BIT_CMDS; i > 0; i--)
 	{
 		i2c_trn->buf = buf;
-		if (i == 0)
-			i2c_trn->transactType = I2C_T_TX_STOP;
-		lcd_write_int(cmds[cmdIndx++], 1, 0, buf);
+		if (i == 1)
+			i2c_trn->transactType = I2C_T_TX_STOP;		// Last command; finish with a stop.
+		lcd_write_int(lcd_init_cmds[cmdIndx], 1, 0, buf);
 		i2c_trn->numBytes = 4;
 		usi_i2c_txrx_resume();
 		usi_i2c_sleep_wait(1);
-		delay_us(delays[dlyIndx++]);
+		delay_us(lcd_init_delays[cmdIndx++]);
 	}
 
 	// Clean up.
 	i2c_trn->transactType = I2C_T_IDLE;
+	lcd_info.states = (lcd_info.states & ~(LCD_CURSOR_SHOW | LCD_CURSOR_BLINK)) | LCD_DISPLAY_ON;	// Last command 0x0c.
+}
+
+// Arms the init timer; delays shorter than a step's own bus time don't need it.
+static void lcd_init_wait(uint16_t us)
+{
+	uint16_t chunk;
+
+	if (us <= LCD_INIT_MIN_WAIT)
+		return;
+	chunk = (us > LCD_INIT_MAX_CHUNK) ? LCD_INIT_MAX_CHUNK : us;
+	lcd_init_left = us - chunk;
+	lcd_info.states |= LCD_INIT_WAIT;
+	LCD_INIT_CCR = TA0R + chunk * DELAY_1US;
+	LCD_INIT_CCTL = CCIE;
+}
+
+/*
+Starts the asynchronous init.  The expander probe and the HD44780 power on sequence then go out one step at a time
+through lcd_init_async_int() [an I2C job started by the application when lcd_init_pending()], with the delays
+timed on LCD_INIT_CCR so the CPU sleeps and other devices can use the bus in between.
+'powerOnUs' is how long to wait before the first step; the HD44780 wants 40ms from Vcc reaching 2.7V.
+'buf' needs 7 bytes; it is only used while the job holds the USI.
+Turns the backlight on with the first write to the LCD.
+*/
+void lcd_init_async_start(uint16_t powerOnUs, volatile uint8_t *buf)
+{
+	lcd_init_buf = buf;
+	lcd_init_step = LCD_INIT_S_PROBE;
+	lcd_info.states = (lcd_info.states & ~LCD_INITIALISED) | LCD_BACKLIGHT_STATE;
+	lcd_init_wait(powerOnUs);
+}
+
+/*
+1 while the asynchronous init has a step ready to go out [not started, done or waiting on the timer: 0].
+*/
+int lcd_init_pending(void)
+{
+	return ( (lcd_init_buf != NULL) && ((lcd_info.states & LCD_INIT_WAIT) == 0) );
+}
+
+int lcd_initialised(void)
+{
+	return ( (lcd_info.states & LCD_INITIALISED) != 0 );
+}
+
+/*
+I2C job for the asynchronous init [i2c_callback_fnptr_t]: sends one step, then when called back on completion,
+releases the USI and LCD and times the step's delay.
+*/
+void* lcd_init_async_int(i2c_transaction_t *i2c_trn, void *userdata)
+{
+	static uint8_t sent = 0;
+	uint8_t cmd;
+	uint16_t delay;
+	(void)userdata;
+
+	if (!sent)
+	{
+		usi_i2c_get();
+		lcd_get();
+		i2c_trn->callbackFn = lcd_init_async_int;
+		i2c_trn->flags = 0;
+		if (lcd_init_step == LCD_INIT_S_PROBE)
+			prep_expander_probe(i2c_trn, lcd_init_buf);
+		else if (lcd_init_step == LCD_INIT_S_EXPANDER)
+			prep_expander_init(i2c_trn, lcd_init_buf);
+		else
+		{
+			cmd = lcd_init_step - LCD_INIT_S_CMDS;
+			i2c_trn->address = IO_EXPANDER_ADDR;
+			i2c_trn->clkDiv = LCD_I2C_CLK_DIV;
+			i2c_trn->buf = lcd_init_buf;
+			i2c_trn->transactType = I2C_T_TX_STOP;
+			lcd_init_buf[0] = IO_EXP_IO_REG;
+			lcd_write_int(lcd_init_cmds[cmd], LCD_INIT_CMD_FULL(cmd), 0, &lcd_init_buf[1]);
+			i2c_trn->numBytes = LCD_INIT_CMD_FULL(cmd) ? 5 : 3;
+		}
+		sent = 1;
+		usi_i2c_txrx_start(i2c_trn);
+	}
+	else
+	{
+		delay = 0;
+		if (lcd_init_step >= LCD_INIT_S_CMDS)
+		{
+			cmd = lcd_init_step - LCD_INIT_S_CMDS;
+			delay = lcd_init_delays[cmd];
+		}
+		sent = 0;
+		i2c_trn->callbackFn = NULL;
+		i2c_trn->transactType = I2C_T_IDLE;
+		usi_i2c_release();
+		lcd_release();
+		if (lcd_init_step == LCD_INIT_S_PROBE)
+			lcd_init_step = (lcd_init_buf[0] == 0xff) ? LCD_INIT_S_EXPANDER : LCD_INIT_S_CMDS;	// Already set up if not 0xff.
+		else if (lcd_init_step == LCD_INIT_S_EXPANDER)
+			lcd_init_step = LCD_INIT_S_CMDS;
+		else
+		{
+			lcd_init_wait(delay);
+			if (++lcd_init_step == LCD_INIT_S_CMDS + LCD_INIT_CMDS)
+			{
+				lcd_init_buf = NULL;
+				lcd_info.states = (lcd_info.states & ~(LCD_CURSOR_SHOW | LCD_CURSOR_BLINK)) | LCD_INITIALISED | LCD_DISPLAY_ON;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+Timer_A0 LCD_INIT_CCR handler; call from the TIMER0_A1 ISR.
+Returns non-zero when the init delay is over and main() should be woken to send the next step.
+*/
+int lcd_init_tick(void)
+{
+	uint16_t chunk;
+
+	if (lcd_init_left)
+	{
+		chunk = (lcd_init_left > LCD_INIT_MAX_CHUNK) ? LCD_INIT_MAX_CHUNK : lcd_init_left;
+		lcd_init_left -= chunk;
+		LCD_INIT_CCR += chunk * DELAY_1US;
+		return 0;
+	}
+	LCD_INIT_CCTL = 0;
+	lcd_info.states &= ~LCD_INIT_WAIT;
+	return 1;
 }
 
 /*
@@ -179,42 +353,60 @@ Assumptions:
 */
 int lcd_write_int(uint8_t val, uint8_t nibbleMode, uint8_t rs, volatile uint8_t *buf)
 {
-	const uint8_t mask =	(1 << BACKLIGHT_PORT) |
-							(1 << DB7_PORT) | (1 << DB6_PORT) | (1 << DB5_PORT) | (1 << DB4_PORT) |
-							(1 << RS_PORT);	//0xfa
-
-	uint8_t temp;
-	uint8_t backlightState = lcd_info.states & LCD_BACKLIGHT_STATE;
+	uint8_t i;
 
 	rs = (rs > 0) ? 1 : 0;
 
 	//A "byte" transfer is really just the upper nibble.
-	temp = (((val & 0xf0) >> (7 - DB7_PORT)) | (rs << RS_PORT) | (backlightState << BACKLIGHT_PORT)) & mask;	//upper nibble
-	buf[0] = temp | (1 << E_PORT);
-	buf[1] = temp;
+	for (i = 0; i < ((nibbleMode) ? 4 : 2); i++)
+		buf[i] = lcd_encode_phase(val, i, rs);
 
-	if (nibbleMode)
-	{
-		temp = (((val & 0x0f) << DB4_PORT) | (rs << RS_PORT) | (backlightState << BACKLIGHT_PORT)) & mask;	//lower nibble
-		buf[2] = temp | (1 << E_PORT);
-		buf[3] = temp;
-	}
 	return 1;		// The caller handles the rest.
 }
 
+/*
+Scatter-gather transforms [i2c_xform_fnptr_t] that do the lcd_write_int() encoding on the fly.
+Use with reps = LCD_BUS_BYTES_PER_CHAR so that a command or string can go out in the same
+transaction as the expander register byte.
+*/
+uint8_t lcd_xform_cmd(uint8_t data, uint8_t phase)
+{
+	return lcd_encode_phase(data, phase, 0);
+}
+
+uint8_t lcd_xform_char(uint8_t data, uint8_t phase)
+{
+	return lcd_encode_phase(data, phase, 1);
+}
+
+/*
+RS changes between E pulses, in writes of their own [see the bus encoding in lcd.h]: lcd_xform_rs_char() raises it ahead of the first
+character [reps = LCD_BUS_RS_BYTES], lcd_xform_rs_cmd() drops it after the last [reps = 1].
+*/
+uint8_t lcd_xform_rs_char(uint8_t data, uint8_t phase)
+{
+	return (phase & 0x01) ? data : (LCD_CTRL_REST | (1 << RS_PORT));
+}
+
+uint8_t lcd_xform_rs_cmd(uint8_t data, uint8_t phase)
+{
+	(void)data;
+	(void)phase;
+	return LCD_CTRL_REST;
+}
+
 /*
 Turn the backlight pin on or off.
 0 = off, 1 = on.
 */
 int lcd_set_backlight_int(int state, i2c_transaction_t *i2c_trans)
 {
-	if (usi_i2c_busy())
-		return 0;									// I2C is busy.  <-- Probably don't need to check this as the caller(s) should have already checked.
-
+	// No USI busy check here; the transaction may be posted behind whatever is on the bus.
 	lcd_info.states = (lcd_info.states & ~LCD_BACKLIGHT_STATE) | ((state == 0) ? 0 : LCD_BACKLIGHT_STATE);
 	i2c_trans->address = IO_EXPANDER_ADDR;
+	i2c_trans->clkDiv = LCD_I2C_CLK_DIV;
 	i2c_trans->buf[0] = IO_EXP_IO_REG;
-	i2c_trans->buf[1] = (lcd_info.states & LCD_BACKLIGHT_STATE) << (BACKLIGHT_PORT - LCD_BACKLIGHT_STATE - 1);
+	i2c_trans->buf[1] = (lcd_info.states & LCD_BACKLIGHT_STATE) << BACKLIGHT_PORT;
 	i2c_trans->numBytes = 2;
 	i2c_trans->transactType = I2C_T_TX_STOP;
 	return 1;										// The caller will handle the rest.
@@ -226,6 +418,7 @@ static int send_lcd_cmd_int(uint8_t val, i2c_transaction_t *i2c_trans)
 		return 0;									// I2C is busy.
 
 	i2c_trans->address = IO_EXPANDER_ADDR;
+	i2c_trans->clkDiv = LCD_I2C_CLK_DIV;
 	i2c_trans->buf[0] = IO_EXP_IO_REG;
 	i2c_trans->buf[1] = val;
 	lcd_write_int(val, 1, 0, &(i2c_trans->buf[1]));
@@ -274,12 +467,38 @@ int lcd_show_cursor_int(i2c_transaction_t *i2c_trans)
 	return 0;
 }
 
+/*
+Display off [0x08]; DDRAM and CGRAM keep their contents, so display on brings the same screen back.
+*/
 int lcd_display_off_int(i2c_transaction_t *i2c_trans)
 {
-	return send_lcd_cmd_int(0x0c, i2c_trans);
+	if (send_lcd_cmd_int(0x08, i2c_trans))
+	{
+		lcd_info.states &= ~(LCD_DISPLAY_ON | LCD_CURSOR_SHOW | LCD_CURSOR_BLINK);
+		return 1;
+	}
+	return 0;
+}
+
+// Display on, cursor off, blinking off [0x0c].
+int lcd_display_on_int(i2c_transaction_t *i2c_trans)
+{
+	if (send_lcd_cmd_int(0x0c, i2c_trans))
+	{
+		lcd_info.states = (lcd_info.states & ~(LCD_CURSOR_SHOW | LCD_CURSOR_BLINK)) | LCD_DISPLAY_ON;
+		return 1;
+	}
+	return 0;
+}
+
+int lcd_get_display_state(void)
+{
+	return ((lcd_info.states & LCD_DISPLAY_ON) != 0);
 }
 
 int lcd_get_backlight_state(void)
 {
 	return ((lcd_info.states & LCD_BACKLIGHT_STATE) != 0);
 }
+
+
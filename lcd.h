@@ -31,9 +31,29 @@
 #include <string.h>
 #include "msp430_usi_i2c_int.h"
 
+/*
+Bus encoding: how an HD44780 byte is put on the expander pins.
+The expander changes all of its outputs together at the end of each data byte, so a pin that has to be stable
+across an E edge can't change in the write that makes the edge; anything else is covered by the byte time
+[>= 9us].  HD44780 at Vcc 2.7-4.5V: RS and R/W set up 60ns before E rises [tAS], held 20ns after it falls
+[tAH]; data set up 195ns before E falls [tDSW], held 10ns [tH]; E high 450ns, E cycle 1000ns.
+Every transfer needs a write that raises E and one that drops it with the data unchanged; in 4-bit mode that is
+nibble + E high, nibble + E low per nibble, 4 bytes per character [LCD_BUS_BYTES_PER_CHAR].
+There is no write to spare: a write makes at most one E edge and a 4-bit transfer needs four [two pulses].
+Loading the next data in the write that drops E saves nothing either, and breaks tH.  An MCP23017 driving the
+HD44780 in 8-bit mode doesn't get under 4 either: the byte still needs an E rise and an E fall around stable data,
+and with E on GPA and the data on GPB the A/B pointer toggle makes that A, B, A, B.
+RS can't change in an E edge write either, so a line [command, then characters] raises RS in LCD_BUS_RS_BYTES
+before the first character and drops it in one byte after the last.  Between transfers the bus rests with RS,
+R/W and E low.
+Over I2C the bus bytes come at most one per 9 SCL clocks, longer than the HD44780 takes over a transfer [37us for
+4 of them at 1MHz], so the driver needs no delays between them.
+*/
 #define IO_EXPANDER_ADDR	0x40
+#define IO_EXP_DIR_REG		0x00
 #define IO_EXP_CONF_REG		0x05
 #define IO_EXP_IO_REG		0x09
+#define LCD_BUS_RS_BYTES	1
 #define BACKLIGHT_PORT		7
 #define DB7_PORT			6
 #define DB6_PORT			5
@@ -41,6 +61,22 @@
 #define DB4_PORT			3
 #define E_PORT				2
 #define RS_PORT				1
+#define LCD_BUS_BYTES_PER_CHAR	4				// Expander writes per HD44780 byte.
+#define LCD_I2C_CLK_DIV		USIDIV_4			// 1MHz SCL at 16MHz; the MCP23008 is good to 1.7MHz.  USIDIV_5 for long wires or weak pull-ups.
+
+// Display geometry; rows start at the DDRAM addresses in gLcdRowOffsets[].  Also picks the application's screen layouts.
+#define LCD_1602			1602				// 16x2
+#define LCD_2004			2004				// 20x4
+#ifndef LCD_GEOMETRY
+#define LCD_GEOMETRY		LCD_2004
+#endif
+#if LCD_GEOMETRY == LCD_1602
+#define LCD_COLS			16
+#define LCD_ROWS			2
+#else
+#define LCD_COLS			20
+#define LCD_ROWS			4
+#endif
 
 // Delays - for feeding into __delay_cycles(); adjust F_BRCLK as necessary.
 #ifndef F_BRCLK
@@ -64,12 +100,23 @@
 #endif
 #define LCD_BLINK_DELAY		((F_BRCLK)/4)		//250 milliseconds
 
+// Asynchronous init [lcd_init_async_start()]; the delays are timed on a Timer_A0 compare register.
+#define LCD_POWER_ON_DELAY	40000u				// us from power up to the first command; HD44780 at Vcc = 2.7V.
+#define LCD_INIT_MIN_WAIT	50u					// us; shorter delays are covered by the bus time of the next step.
+#define LCD_INIT_MAX_CHUNK	4000u				// us per compare; must fit 16 bits of Timer_A0 ticks.
+#define LCD_INIT_CCR		TA0CCR1
+#define LCD_INIT_CCTL		TA0CCTL1
+
+#define IO_EXP_IOCON		0x20				// IOCON as the expander setup leaves it [SEQOP].
+
 
 // Defines for LCD states and flags.
 #define LCD_BACKLIGHT_STATE	0x01
 #define LCD_DISPLAY_ON		0x02
 #define LCD_CURSOR_SHOW		0x04
 #define LCD_CURSOR_BLINK	0x08
+#define LCD_INITIALISED		0x10				// The asynchronous init has finished.
+#define LCD_INIT_WAIT		0x20				// Timing an init delay.
 #define LCD_BUSY			0x40
 #define LCD_EVENT_SIG		0x80
 
@@ -83,6 +130,7 @@ typedef union _lcd_sys_info_t
 
 // Variables
 extern const uint16_t gSysSleepMode;
+extern const uint8_t gLcdRowOffsets[LCD_ROWS];
 
 // Exposed Functions
 //void delay_us(uint16_t count);
@@ -95,12 +143,24 @@ void lcd_clear_event(void);
 int lcd_check_io_expander_no_init_int(i2c_transaction_t * i2c_trn, volatile uint8_t *buf);
 void lcd_io_expander_init_int(i2c_transaction_t * i2c_trn, volatile uint8_t *buf);
 void lcd_init_int(i2c_transaction_t * i2c_trn, volatile uint8_t *buf);
+void lcd_init_async_start(uint16_t powerOnUs, volatile uint8_t *buf);
+int lcd_init_pending(void);
+int lcd_initialised(void);
+void* lcd_init_async_int(i2c_transaction_t *i2c_trn, void *userdata);
+int lcd_init_tick(void);
 int lcd_write_int(uint8_t val, uint8_t nibbleMode, uint8_t rs, volatile uint8_t *buf);
+uint8_t lcd_xform_cmd(uint8_t data, uint8_t phase);
+uint8_t lcd_xform_char(uint8_t data, uint8_t phase);
+uint8_t lcd_xform_rs_char(uint8_t data, uint8_t phase);
+uint8_t lcd_xform_rs_cmd(uint8_t data, uint8_t phase);
 int lcd_set_backlight_int(int state, i2c_transaction_t *i2c_trans);
 int lcd_clear_int(i2c_transaction_t *i2c_trans);
 int lcd_home_int(i2c_transaction_t *i2c_trans);
 int lcd_blink_cursor_int(i2c_transaction_t *i2c_trans);
 int lcd_show_cursor_int(i2c_transaction_t *i2c_trans);
+int lcd_display_off_int(i2c_transaction_t *i2c_trans);
+int lcd_display_on_int(i2c_transaction_t *i2c_trans);
 int lcd_get_backlight_state(void);
+int lcd_get_display_state(void);
 
 #endif /* LCD_H_ */
@@ -0,0 +1,69 @@
+/*
+ * lcd_layout.c
+ *
+ * Field renderer for the declarative screen layouts [see lcd_layout.h].
+ * Each field of the current layout has a stale bit; touching a value sets the bits of the fields that show it and
+ * the renderer hands out the stale fields one display line at a time, lowest index first.
+ */
+
+#include "lcd_layout.h"
+
+// #########################
+// Global Variables
+static const lcd_layout_t	*layout_cur;			// Layout on the display; NULL before the first lcd_layout_select().
+static uint16_t				layout_stale;			// Fields to redraw; bit n = layout_cur->fields[n].
+
+// #########################
+// Function Definitions
+
+/*
+ * Puts a layout on the display; every field is redrawn.
+ * Cells the layout doesn't cover keep whatever was there, so clear the display when switching between layouts.
+ */
+void lcd_layout_select(const lcd_layout_t *pLayout)
+{
+	layout_cur = pLayout;
+	layout_stale = (pLayout->numFields >= LCD_LAYOUT_MAX_FIELDS) ? 0xffff : ((1u << pLayout->numFields) - 1);
+}
+
+/*
+ * The values in 'values' have changed; marks the fields that show them for redrawing.
+ */
+void lcd_layout_touch(uint8_t values)
+{
+	uint8_t i;
+
+	if (layout_cur == NULL)
+		return;
+	for (i = 0; i < layout_cur->numFields; i++)
+		if (layout_cur->fields[i].values & values)
+			layout_stale |= 1u << i;
+}
+
+// 1 if any field is waiting to be redrawn.
+int lcd_layout_pending(void)
+{
+	return (layout_stale != 0);
+}
+
+/*
+ * Formats the first stale field into 'line' as a display line for the LCD line write: line[0] is the set DDRAM
+ * address command, then the field's characters and a NUL.  'line' needs the widest field + 2 bytes.
+ * The field counts as drawn from here on; a touch while it's going out marks it stale again.
+ * Returns 1 with the line ready, or 0 if nothing is stale.
+ */
+int lcd_layout_next_field(volatile uint8_t *line)
+{
+	const lcd_layout_field_t *f;
+	uint8_t i;
+
+	if (layout_stale == 0)
+		return 0;
+	for (i = 0; (layout_stale & (1u << i)) == 0; i++);
+	layout_stale &= ~(1u << i);
+	f = &layout_cur->fields[i];
+	line[0] = 0x80 | (gLcdRowOffsets[f->row] + f->col);
+	f->fmt((uint8_t *)&line[1], f->width, f->arg);
+	line[f->width + 1] = '\0';
+	return 1;
+}
@@ -0,0 +1,48 @@
+/*
+ * lcd_layout.h
+ *
+ * Declarative screen layouts.
+ *
+ * A layout is a const table of fields, each with a position, a width, the application values it shows and a
+ * formatter that turns them into text.  The application marks values as changed with lcd_layout_touch(); only
+ * the fields showing them are formatted and sent [lcd_layout_next_field()], so a field whose value hasn't
+ * changed costs nothing.  Fields go out in table order, so put the ones that track user input first.
+ * The layouts for each display geometry [LCD_GEOMETRY] live with the application.
+ */
+
+#ifndef LCD_LAYOUT_H_
+#define LCD_LAYOUT_H_
+
+#include <stdint.h>
+#include "lcd.h"
+
+#define LCD_LAYOUT_MAX_FIELDS	16				// Fields per layout; one stale bit each.
+
+// Fills exactly 'width' characters at buf from whatever 'arg' points to; a NUL after them is harmless.
+typedef void (*lcd_layout_fmt_fnptr_t)( uint8_t *buf, uint8_t width, const void *arg );
+
+typedef struct _lcd_layout_field_t
+{
+	uint8_t					row;
+	uint8_t					col;
+	uint8_t					width;
+	uint8_t					values;			// Application value bits the field shows.
+	lcd_layout_fmt_fnptr_t	fmt;
+	const void*				arg;
+} lcd_layout_field_t;
+
+typedef struct _lcd_layout_t
+{
+	const lcd_layout_field_t*	fields;
+	uint8_t						numFields;
+} lcd_layout_t;
+
+#define LCD_LAYOUT(f)		{ (f), sizeof(f) / sizeof((f)[0]) }
+
+// Provided functions.
+void lcd_layout_select(const lcd_layout_t *pLayout);
+void lcd_layout_touch(uint8_t values);
+int lcd_layout_pending(void);
+int lcd_layout_next_field(volatile uint8_t *line);
+
+#endif /* LCD_LAYOUT_H_ */
@@ -3,7 +3,10 @@
 #include <stdlib.h>
 #include <string.h>						// For memset(), strcpy()
 #include "msp430_usi_i2c_int.h"
+#include "i2c_arbiter.h"
 #include "lcd.h"
+#include "lcd_layout.h"
+#include "backlight.h"
 #include "ds3231m_lib.h"
 #include "ui_update.h"
 #include "datetime.h"
@@ -12,8 +15,27 @@
 // Defines and type definitions
 #define SLEEP_MODE				LPM0_bits
 
-#define SYS_BUF_SZ				24
-#define TMP_BUF_SZ				4
+#define SYS_BUF_SZ				(LCD_COLS + 2)	// A line write: the cursor command, the line and its NUL.  Every RTC read is shorter.
+
+#define DBG_LCD_LINE_TIMING		0		// 1: record the TA0 ticks and wakeups taken by the last line write.
+// I2C retries per device before a failure is reported [see i2c_error()].
+#define I2C_RETRIES_LCD			2
+#define I2C_RETRIES_RTC			3
+// gDt is kept by counting the RTC's 1Hz edges [datetime_tick()]; the RTC itself is read at boot, after config mode
+// and every RTC_RESYNC_S to pick up anything the count missed.  96 reads a day against 86400.
+#define RTC_RESYNC_S			(15u * 60u)
+// I2C arbiter clients [gI2cArbClients], highest priority first.
+#define ARB_LCD_INIT			0		// Next step of the LCD power on sequence.
+#define ARB_RTC_SET				1		// Write a new date and time to the RTC.
+#define ARB_RTC_FETCH			2		// Read the date and time from the RTC.
+#define ARB_LCD_POWER			3		// Display on or off to follow the backlight [bl_dark()].
+#define ARB_LCD_LAYOUT			4		// Stale screen fields; gives way between fields.
+// Values shown by the screen layouts [lcd_layout_touch()].
+#define LAYOUT_V_LABELS			0x01
+#define LAYOUT_V_DATE			0x02
+#define LAYOUT_V_TIME			0x04
+#define LAYOUT_V_SYNC			0x08	// gSyncCount
+#define LAYOUT_V_ASYNC			0x10	// gAsyncCount
 #define ASCII_ZERO				0x30
 #define ASCII_SPACE				0x20
 
@@ -40,7 +62,6 @@
 #define	LCD_BL_BTN				BIT3	// Port 1.3 -> mechanical switch on LP; toggles lcd backlight.  Requires debounce.
 #define RENC_BTN				BIT1	// Port 1.1 -> mechanical pushbutton switch on rotary encoder.  Requires debounce.
 
-// RTC 1-sec input; P1.5
 #define RTC_INT_PIN				BIT5	// Port 1.5.  Digital input from RTC, no debounce required.
 
 // Port 2 #defines
@@ -63,7 +84,7 @@
 #define SYSFLG_ONESEC_EVENT		0x0200u	// One second pulse received from RTC.
 #define SYSFLG_LCD_BACKLIGHT	0x0400u	// Signals an LCD backlight change request to the system.
 #define SYSFLG_FETCH_DATETIME	0x0800u	// Time to fetch the time from the RTC.
-#define SYSFLG_DISP_DATETIME	0x1000u	// Update the date and time displayed on the lcd.
+#define SYSFLG_USER_ACTIVITY	0x1000u	// Rotary encoder turned or its button pressed; restarts the backlight timeout.
 #define SYSFLG_SET_RTC_DATETIME	0x2000u	// Write a new time and date to the RTC.
 #define SYSFLG_CONFIG_MODE		0x4000u	// Is the system in configuration mode?  Normal mode = 0.
 #define SYSFLG_DRAW_NORM_SCRN	0x8000u	// Repaint the normal mode screen. <-- Maybe not necessary?
@@ -75,9 +96,7 @@
 typedef enum
 {
 	LCD_P_SM_SEND_START	= 0,
-	LCD_P_SM_SEND_CURS	= 1,
-	LCD_P_SM_SEND_CHAR	= 2,
-	LCD_P_SM_END		= 3
+	LCD_P_SM_END		= 1
 } enum_lcd_print_sm_t;
 
 typedef enum
@@ -124,80 +143,100 @@ static inline void init_timera0(void);
 static inline void init_port1(void);
 static inline void init_port2(void);
 static inline void init_led(void);
-static inline void init_lcd_int(void);
 static inline void init_i2c_struct(void);
 static inline int sysIsIdle(void);
 static int set_lcd_backlight(uint8_t state, i2c_transaction_t *i2c_trn);
 static inline int wait_for_usi_finish(i2c_transaction_t *i2c_trn);
-static void* drawNrmModeStaticData(i2c_transaction_t *pI2cTrans, void *userdata);
-static inline void asyncEventSM(i2c_transaction_t *pI2cTrans);
-static inline void syncEventSM(i2c_transaction_t *pI2cTrans);
+static void* drawLayoutSM(i2c_transaction_t *pI2cTrans, void *userdata);
+static inline uint16_t i2cJobsReady(void);
+static void* setLcdPower(i2c_transaction_t *pI2cTrans, void *userdata);
 static inline void* fetchRtcTime(i2c_transaction_t *pI2cTrans, void *userdata);
 static inline void* setRtcTime(i2c_transaction_t* pI2cTrans, void* userData);
-static inline void* displayRtcDataSM(i2c_transaction_t *pI2cTrans, void *userdata);
-static inline void changeDateTimeUiSM(void);
-static int put_byte_to_lcd(uint8_t byteToTx, uint8_t byteIsCmd, i2c_transaction_t *i2c_trn);
+static void changeDateTimeUiSM(void);
 static void* putstr_to_lcd_int(i2c_transaction_t *i2c_trn, void *userdata);
-static int prep_str_for_lcd(uint8_t *theStr, uint8_t pos, uint8_t sz);
-uint8_t* itoa(int16_t value, uint8_t *result, uint8_t base);
-uint8_t* utoa(uint16_t value, uint8_t *result, uint8_t base);
 static uint8_t* print_u16(uint8_t *buf, uint16_t value, uint8_t width);
-static inline void prep_time_disp_str(DateTime_t *dt, uint8_t *buf);
-static inline void prep_date_disp_str(DateTime_t *dt, uint8_t *buf);
+static uint8_t* put_digits(uint8_t *buf, uint8_t value, uint8_t bcd, uint8_t delimiter);
+static inline void prep_time_disp_str(const DateTime_t *dt, uint8_t *buf);
+static inline void prep_date_disp_str(const DateTime_t *dt, uint8_t *buf);
+static void fmt_text(uint8_t *buf, uint8_t width, const void *arg);
+static void fmt_u16(uint8_t *buf, uint8_t width, const void *arg);
+static void fmt_date(uint8_t *buf, uint8_t width, const void *arg);
+static void fmt_time(uint8_t *buf, uint8_t width, const void *arg);
+static void i2c_error(i2c_transaction_t *pI2cTrans, enum_usi_i2c_errors_t err);
 
 // #########################
 // Global Variables
 const uint8_t gAsyncDispStr[] 	= "Async: ";
 const uint8_t gSyncDispStr[] 	= "Sync: ";
-const uint8_t gLcdRowOffsets[]	= {0x00, 0x40, 0x14, 0x54}; // Seems to be true for my cheap 20x4 LCD's.
+#if LCD_ROWS == 4
+const uint8_t gLcdRowOffsets[LCD_ROWS]	= {0x00, 0x40, 0x14, 0x54}; // Seems to be true for my cheap 20x4 LCD's.
+#else
+const uint8_t gLcdRowOffsets[LCD_ROWS]	= {0x00, 0x40};
+#endif
 const uint16_t gSysSleepMode	= SLEEP_MODE;
-
-const uint8_t deg00[]			= ".00";
-const uint8_t deg25[]			= ".25";
-const uint8_t deg50[]			= ".50";
-const uint8_t deg75[]			= ".75";
-const uint8_t* const gFracDeg[]	= {deg00, deg25, deg50, deg75};
-
-//Days of the week:
-const uint8_t day0[] = "Sun";
-const uint8_t day1[] = "Mon";
-const uint8_t day2[] = "Tue";
-const uint8_t day3[] = "Wed";
-const uint8_t day4[] = "Thu";
-const uint8_t day5[] = "Fri";
-const uint8_t day6[] = "Sat";
-const uint8_t* const gDaysOfWeek[] = {day0, day1, day2, day3, day4, day5, day6};
-
-//Months
-const uint8_t month0[] = "Jan";
-const uint8_t month1[] = "Feb";
-const uint8_t month2[] = "Mar";
-const uint8_t month3[] = "Apr";
-const uint8_t month4[] = "May";
-const uint8_t month5[] = "Jun";
-const uint8_t month6[] = "Jul";
-const uint8_t month7[] = "Aug";
-const uint8_t month8[] = "Sep";
-const uint8_t month9[] = "Oct";
-const uint8_t month10[] = "Nov";
-const uint8_t month11[] = "Dec";
-const uint8_t* const gMonths[] = {	month0, month1, month2, month3,
-									month4, month5, month6, month7,
-									month8, month9, month10, month11 };
+const uint8_t gIoExpIoReg		= IO_EXP_IO_REG;
+const i2c_retry_policy_t gI2cRetryPolicy[] = {	{ IO_EXPANDER_ADDR, I2C_RETRIES_LCD },
+												{ RTC_ADDR, I2C_RETRIES_RTC },
+												{ 0, 0 } };
+const i2c_arb_client_t gI2cArbClients[I2C_ARB_NUM_CLIENTS] = {	{ lcd_init_async_int },		// ARB_LCD_INIT
+																{ setRtcTime },				// ARB_RTC_SET
+																{ fetchRtcTime },			// ARB_RTC_FETCH
+																{ setLcdPower },			// ARB_LCD_POWER
+																{ drawLayoutSM } };			// ARB_LCD_LAYOUT
+
+//Days of the week and months; three letters each, not NUL terminated.
+const uint8_t gDaysOfWeek[7][3] = {	"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+const uint8_t gMonths[12][3] = {	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+									"Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
 
 volatile uint16_t				gSysFlags;
 //volatile uint8_t				gSysFlags;
 volatile uint8_t				gAsyncBtnDebounceCounter;
 volatile uint8_t				gRencBtnDebounceCounter;
 volatile uint8_t				gSysBuf[SYS_BUF_SZ];
-volatile uint8_t				gTmpBuf[TMP_BUF_SZ];
+#if DBG_LCD_LINE_TIMING == 1
+uint16_t						gLcdLineTicks;			// SMCLK ticks from the start of the last line to its completion.
+uint8_t							gLcdLineWakes;			// Times main() was woken to service the last line.
+#endif
+volatile uint8_t				gBlBuf[2];
 uint16_t						gAsyncCount;
 uint16_t						gSyncCount;
+uint16_t						gRtcSyncS;				// Seconds since the last RTC read.
 //volatile uint8_t				gUiTimeoutTmr;
 i2c_transaction_t				gsI2Ctransact;
+i2c_transaction_t				gsBlTransact;			// Backlight writes are posted [usi_i2c_post()].
+volatile uint8_t				gI2cErrCount;			// I2C transactions that failed after their retries.
+volatile uint8_t				gI2cLastErr;			// enum_usi_i2c_errors_t of the last failure.
+volatile uint8_t				gI2cLastErrAddr;		// Device address of the last failure.
+
+// A display line as one I2C transaction: expander register, cursor position command, then the NUL terminated string.
+// RS goes up and down in writes of its own around the string [see the bus encoding in lcd.h].
+const i2c_segment_t				gLcdLineSegs[] = {	{ &gIoExpIoReg, 1, 1, NULL },
+													{ &gSysBuf[0], 1, LCD_BUS_BYTES_PER_CHAR, lcd_xform_cmd },
+													{ &gSysBuf[1], 1, LCD_BUS_RS_BYTES, lcd_xform_rs_char },
+													{ &gSysBuf[1], 0, LCD_BUS_BYTES_PER_CHAR, lcd_xform_char },
+													{ &gSysBuf[0], 1, 1, lcd_xform_rs_cmd },
+													I2C_SEG_END };
 DateTime_t						gDt;
 //state_vars_t					gStateVars;
 
+// Normal mode screen, one layout per display geometry [LCD_GEOMETRY].  Fields are redrawn in table order.
+#if LCD_GEOMETRY == LCD_1602
+const uint8_t gAsyncShortStr[]	= "A:";
+const lcd_layout_field_t		gNormFields[] = {	{ 1, 11, 5,  LAYOUT_V_ASYNC,	fmt_u16,	&gAsyncCount },
+													{ 1, 0,  8,  LAYOUT_V_TIME,		fmt_time,	&gDt },
+													{ 0, 0,  13, LAYOUT_V_DATE,		fmt_date,	&gDt },
+													{ 1, 9,  2,  LAYOUT_V_LABELS,	fmt_text,	gAsyncShortStr } };
+#else
+const lcd_layout_field_t		gNormFields[] = {	{ 3, 7,  5,  LAYOUT_V_ASYNC,	fmt_u16,	&gAsyncCount },
+													{ 1, 0,  8,  LAYOUT_V_TIME,		fmt_time,	&gDt },
+													{ 0, 0,  13, LAYOUT_V_DATE,		fmt_date,	&gDt },
+													{ 2, 6,  5,  LAYOUT_V_SYNC,		fmt_u16,	&gSyncCount },
+													{ 2, 0,  6,  LAYOUT_V_LABELS,	fmt_text,	gSyncDispStr },
+													{ 3, 0,  7,  LAYOUT_V_LABELS,	fmt_text,	gAsyncDispStr } };
+#endif
+const lcd_layout_t				gNormLayout = LCD_LAYOUT(gNormFields);
+
 
 // #########################
 // Function Definitions
@@ -220,39 +259,25 @@ int _system_pre_init(void)
 }
 int main(void)
 {
-	const uint16_t sysFlagMask = (uint16_t)(SYSFLG_ONESEC_EVENT | SYSFLG_LCD_BACKLIGHT | SYSFLG_SYNCSYSEVENT | SYSFLG_ASYNCSYSEVENT);
-	//const uint8_t sysFlagMask = (uint8_t)(SYSFLG_FETCH_DATETIME | SYSFLG_LCD_BACKLIGHT | SYSFLG_SYNCSYSEVENT | SYSFLG_ASYNCSYSEVENT);
-
-	gSysFlags = (SYSFLG_ASYNCSYSEVENT | SYSFLG_SYNCSYSEVENT | SYSFLG_RENC_DIR);// Feed events to start off.
+	gSysFlags = (SYSFLG_SYNCSYSEVENT | SYSFLG_RENC_DIR |						// Feed events to start off.
+				 SYSFLG_DRAW_NORM_SCRN | SYSFLG_FETCH_DATETIME);				// The screen is drawn as soon as the LCD is up.
 
 	init_i2c_struct();
 
-	usi_i2c_master_init(USISSEL_2, USIDIV_5);				// USI Clock = SMCLK, Divider = 32; yields 500kHz I2C.
+	usi_i2c_set_retry_policy(gI2cRetryPolicy);
+	usi_i2c_set_error_callback(i2c_error);
+	usi_i2c_master_init(USISSEL_2, USIDIV_5);				// USI Clock = SMCLK, Divider = 32; yields 500kHz I2C.  Devices pick their own rate [clkDiv].
 	//usi_i2c_master_init(USISSEL_2, USIDIV_7);				// USI Clock = SMCLK, Divider = 128; yields 125kHz I2C.
 	init_port1();
 	init_port2();
 	init_led();
 	init_timera0();
+	bl_init();
+	lcd_init_async_start(LCD_POWER_ON_DELAY, gSysBuf);		// The LCD init runs from the main loop; the RTC gets the bus during its delays.
 	ds3231m_init(&gsI2Ctransact, gSysBuf);
-	//gsI2Ctransact.buf = gSysBuf;
-	//ds3231m_set_time_dbg(NULL, &gsI2Ctransact);
-
-	__delay_cycles(600000);									// Settle DCO a bit; if it's shorter, the lcd init doesn't seem to work.
-
-	init_lcd_int();
-
-	prep_str_for_lcd((uint8_t *)gSyncDispStr, 0x14, 0);
-	putstr_to_lcd_int(&gsI2Ctransact, NULL);
-	wait_for_usi_finish(&gsI2Ctransact);
-
-	prep_str_for_lcd((uint8_t *)gAsyncDispStr, 0x54, 0);
-	putstr_to_lcd_int(&gsI2Ctransact, NULL);
-	wait_for_usi_finish(&gsI2Ctransact);
-
 
 	P1IE = (RENC_BTN | LCD_BL_BTN | RTC_INT_PIN);			// Enable P1.1, P1.3, P1.5 interrupts.
 	P2IE = (RENC_SIGB | RENC_SIGA);							// Enable P2.0, P2.1 interrupts.
-	TA0CTL |= MC_2;											// Counter in continuous mode.
 	TA0CCTL0 = CCIE;										// Enable TimerA0_0 compare interrupt.
 
     for (;;)
@@ -267,6 +292,7 @@ int main(void)
     			usi_i2c_release();							// Release the USI and LCD since no callback.
     			lcd_release();
     			gsI2Ctransact.transactType = I2C_T_IDLE;
+    			gsI2Ctransact.flags = 0;
     		}
     		else											// Call the callback function.
     		{
@@ -274,6 +300,29 @@ int main(void)
     		}
     	}
 
+    	if (usi_i2c_check_post_event())						// The posted I2C transaction has finished; nothing to follow up.
+    		usi_i2c_clear_post_event();
+
+    	if ( lcd_initialised() && !bl_pwm_active() )		// CCR1 is free once the LCD init is done.
+    		bl_start();
+
+    	if (gSysFlags & SYSFLG_LCD_BACKLIGHT)				// The backlight button: fade out, or back in.
+    	{
+    		gSysFlags &= ~SYSFLG_LCD_BACKLIGHT;
+    		bl_toggle();
+    	}
+
+    	if (gSysFlags & SYSFLG_USER_ACTIVITY)				// Any input brings the backlight back and restarts its timeout.
+    	{
+    		gSysFlags &= ~SYSFLG_USER_ACTIVITY;
+    		bl_activity();
+    	}
+
+    	// The expander backlight pin follows the PWM being lit at all.
+    	// It's posted so it doesn't have to wait for the bus to be free.
+    	if ( lcd_initialised() && ((!bl_dark()) != lcd_get_backlight_state()) )
+    		set_lcd_backlight(!bl_dark(), &gsBlTransact);
+
     	if (gSysFlags & SYSFLG_RENC_ROT_EVENT)				// A rotary encoder rotation event is raised.
     	{
     		if (gSysFlags & SYSFLG_CONFIG_MODE)				// If in UI update mode.
@@ -283,7 +332,7 @@ int main(void)
     		else											// Only raise the asynchronous event if in normal mode.
     		{
     			((gSysFlags & SYSFLG_RENC_DIR) == 0) ? gAsyncCount-- : gAsyncCount++;
-    			gSysFlags |= SYSFLG_ASYNCSYSEVENT;			// Raise the async event.
+    			lcd_layout_touch(LAYOUT_V_ASYNC);			// Redraw the counter.
     			gSysFlags &= ~SYSFLG_RENC_ROT_EVENT;		// Consume the rotary encoder rotation event.
     		}
     	}
@@ -291,15 +340,27 @@ int main(void)
     	if (gSysFlags & SYSFLG_ONESEC_EVENT)				// A 1 second pulse has been received from the RTC.
     	{
     		gSysFlags &= ~SYSFLG_ONESEC_EVENT;				// Consume the 1 second event.
-    		if ( !(gSysFlags & (SYSFLG_CONFIG_MODE|SYSFLG_SET_RTC_DATETIME)) )	// If not in config mode or need to send a new time to the RTC.
-    			gSysFlags |= SYSFLG_FETCH_DATETIME;			// Raise the date/time update event.
+    		if (!(gSysFlags & (SYSFLG_CONFIG_MODE|SYSFLG_SET_RTC_DATETIME)))	// gDt isn't being edited or waiting to go to the RTC.
+    		{
+    			lcd_layout_touch(LAYOUT_V_TIME | ((datetime_tick(&gDt)) ? LAYOUT_V_DATE : 0));	// Keep time locally.
+    			if (++gRtcSyncS >= RTC_RESYNC_S)
+    				gSysFlags |= SYSFLG_FETCH_DATETIME;		// Resync from the RTC; straight after the edge.
+    		}
+    		bl_second((gDt.bcd_format) ? bcdToDec8(gDt.hours) : gDt.hours);	// Backlight timeout and night dimming.
      	}
 
     	if (gSysFlags & SYSFLG_SYNCSYSEVENT)
     	{
 			gSyncCount++;
-			if (gSysFlags & SYSFLG_CONFIG_MODE)				// Clear sync event flag if in config mode.
-					gSysFlags &= ~SYSFLG_SYNCSYSEVENT;
+			gSysFlags &= ~SYSFLG_SYNCSYSEVENT;				// Consume the sync event.
+			if (!(gSysFlags & SYSFLG_CONFIG_MODE))			// Sync updates only in normal mode.
+				lcd_layout_touch(LAYOUT_V_SYNC);
+    	}
+
+    	if (gSysFlags & SYSFLG_DRAW_NORM_SCRN)				// Repaint the whole normal mode screen.
+    	{
+    		gSysFlags &= ~SYSFLG_DRAW_NORM_SCRN;
+    		lcd_layout_select(&gNormLayout);				// Every field is stale; drawn once the LCD is up.
     	}
 
     	if (gSysFlags & SYSFLG_RENC_BTN_LNG)				// Detected a long rotary encoder button press.
@@ -312,47 +373,10 @@ int main(void)
     		changeDateTimeUiSM();							// Call the UI update state machine.
     	}
 
-    	// The events wrapped in here all depend on the USI and LCD being free
-    	// and are ordered more or less by priority/importance.
-    	// The if-else if structure guards against an isr setting a flag for a statemachine
-    	// that also requires the usi and lcd while we're 'inside' the outer if.
-    	// This way only one state machine or routine 'wins'.
-    	// If all of the flag cases were evaluated then there would be the potential for
-    	// one state machine to clobber the data for another.
-    	if ( (gSysFlags & sysFlagMask) && !usi_i2c_busy() && !lcd_busy() )
-    	{
-    		if (gSysFlags & SYSFLG_SET_RTC_DATETIME)		// Write a new date and time to the RTC.
-    		{
-    			setRtcTime(&gsI2Ctransact, NULL);
-    		}
-
-    		else if (gSysFlags & SYSFLG_ASYNCSYSEVENT)		// Asynchronous event detected [button press].
-    		{
-    			asyncEventSM(&gsI2Ctransact);				// Start the async event function.
-    		}
-
-    		else if (gSysFlags & SYSFLG_SYNCSYSEVENT)		// Synchronous system event detected [timer0].
-    		{
-    			if (0 == (gSysFlags & SYSFLG_CONFIG_MODE))	// Only raise the synchronous event if in normal mode.  Guards if the sync event is raised while in here.
-    				syncEventSM(&gsI2Ctransact);			// Start the sync event function.
-    		}
-
-    		else if (gSysFlags & SYSFLG_FETCH_DATETIME)		// A one second 'tick' has been received from the RTC and has triggered a date/time update.
-    		{
-    			fetchRtcTime(&gsI2Ctransact, NULL);			// Go get the date and time from the RTC.
-    		}
-
-    		else if (gSysFlags & SYSFLG_DISP_DATETIME)		// A request to update the date and time on the display has been flagged.
-    		{
-    			displayRtcDataSM(&gsI2Ctransact, NULL);		// Update the display with the current date and time.
-    		}
-
-    		else if (gSysFlags & SYSFLG_LCD_BACKLIGHT)		// A request to toggle the LCD backlight has been made.
-    		{
-        		if ( set_lcd_backlight((lcd_get_backlight_state() ^ 1), &gsI2Ctransact) )
-        			gSysFlags &= ~SYSFLG_LCD_BACKLIGHT;
-    		}
-    	}
+    	// The jobs that need the USI and LCD go through the arbiter; it starts the highest priority one that has
+    	// work whenever the USI is free, so only one job owns gsI2Ctransact and gSysBuf at a time.
+    	// A job that takes the USI also takes the LCD, so the USI being free is enough.
+    	i2c_arb_dispatch(&gsI2Ctransact, i2cJobsReady());
 
     	P1OUT ^= DBG_LED;
    		if (sysIsIdle())
@@ -368,16 +392,19 @@ int main(void)
 
 // Inits...
 /* *********************************************************************************
- * Initializes TimerA0 in up count mode.
+ * Initializes TimerA0 in continuous count mode.
  * CCR0 is configured to "free run".
  * Various system delays can be implemented based on the CCRx registers.
  * The high speed tick is always active and is controlled via CCR0.
+ * CCR1 times the LCD init delays [see lcd_init_async_start()], then runs the backlight PWM on TA0.1 [see backlight.h].
+ * CCR2 is the I2C driver's bus watchdog; the counter is started here so that it also covers the LCD init.
 ********************************************************************************* */
 static inline void init_timera0(void)
 {
 	TA0CTL = TASSEL_2 | MC_0 | TACLR;	// SMCLK; Timer stopped, Timer cleared.
 	TA0CCR0 = HS_SYSTICK_TIMER_VAL;		// Will allow for a 100us system tick at SMCLK = 16MHz. [62.5ns * 1600 = 100us].
 	//TA0CCTL0 = CCIE;					// Compare match interrupt enabled for TA0.0.
+	TA0CTL |= MC_2;						// Counter in continuous mode.  The systick interrupt is turned on later.
 }
 
 static inline void init_port1(void)
@@ -406,36 +433,19 @@ static inline void init_led(void)
 	P1OUT &= ~DBG_LED;					// LED off.
 }
 
-static inline void init_lcd_int(void)
-{
-	if (lcd_check_io_expander_no_init_int(&gsI2Ctransact, gSysBuf))
-		lcd_io_expander_init_int(&gsI2Ctransact, gSysBuf);
-
-	lcd_init_int(&gsI2Ctransact, gTmpBuf);
-
-	gsI2Ctransact.buf = gSysBuf;
-	while (!lcd_set_backlight_int(1, &gsI2Ctransact));
-	usi_i2c_txrx_start(&gsI2Ctransact);
-
-	usi_i2c_sleep_wait(1);									// Sleep wait for the i2c transaction to be done.
-
-	gsI2Ctransact.transactType = I2C_T_IDLE;
-	gsI2Ctransact.buf = gSysBuf;
-
-	while (!lcd_clear_int(&gsI2Ctransact));
-	usi_i2c_txrx_start(&gsI2Ctransact);
-
-	usi_i2c_sleep_wait(1);									// Sleep wait for the i2c transaction to be done.
-	__delay_cycles(LCD_CLEAR_DELAY);						// The high speed timer isn't running yet so we have to spin-wait.
-
-	gsI2Ctransact.transactType = I2C_T_IDLE;				// Clean up.
-}
-
 static inline void init_i2c_struct(void)
 {
 	gsI2Ctransact.callbackFn = NULL;
 	gsI2Ctransact.buf = gSysBuf;
 	gsI2Ctransact.transactType = I2C_T_IDLE;
+	gsI2Ctransact.flags = 0;
+	gsI2Ctransact.clkDiv = I2C_CLK_DEFAULT;
+
+	gsBlTransact.callbackFn = NULL;
+	gsBlTransact.buf = gBlBuf;
+	gsBlTransact.transactType = I2C_T_IDLE;
+	gsBlTransact.status = I2C_TS_IDLE;
+	gsBlTransact.flags = 0;
 }
 
 // Utility functions...
@@ -453,16 +463,58 @@ static inline int sysIsIdle(void)
 	return ( !(usi_i2c_check_event()) || ((gSysFlags & ~(SYSFLG_ASYNCSYSEVENT | SYSFLG_SYNCSYSEVENT)) == 0) );
 }
 
-static int set_lcd_backlight(uint8_t state, i2c_transaction_t *i2c_trn)
+// One bit per I2C arbiter client that has work to do [see gI2cArbClients].
+static inline uint16_t i2cJobsReady(void)
 {
-	if ( !(lcd_set_backlight_int(state, i2c_trn)) )
-		return 0;
-	usi_i2c_get();
-	lcd_get();
-	i2c_trn->callbackFn = NULL;
-	usi_i2c_txrx_start(i2c_trn);
+	uint16_t ready = 0;
+
+	if (lcd_init_pending())
+		ready |= 1u << ARB_LCD_INIT;
+	if (gSysFlags & SYSFLG_SET_RTC_DATETIME)
+		ready |= 1u << ARB_RTC_SET;
+	if (gSysFlags & SYSFLG_FETCH_DATETIME)
+		ready |= 1u << ARB_RTC_FETCH;
+	if (!lcd_initialised())
+		return ready;											// The LCD jobs wait for the init.
+	if ((!bl_dark()) != lcd_get_display_state())
+		ready |= 1u << ARB_LCD_POWER;
+	if ( lcd_layout_pending() && lcd_get_display_state() )		// Touches pile up while the display is off.
+		ready |= 1u << ARB_LCD_LAYOUT;
+	return ready;
+}
 
-	return 1;
+// Turns the display off once the backlight has faded out, and back on before it fades in.
+// One command; main() cleans up on completion [callbackFn NULL].
+static void* setLcdPower(i2c_transaction_t *pI2cTrans, void *userdata)
+{
+	(void)userdata;
+	pI2cTrans->buf = gSysBuf;
+	pI2cTrans->callbackFn = NULL;
+	if ( (bl_dark()) ? lcd_display_off_int(pI2cTrans) : lcd_display_on_int(pI2cTrans) )
+	{
+		usi_i2c_get();											// Take the USI.
+		lcd_get();												// Take the LCD.
+		usi_i2c_txrx_start(pI2cTrans);
+	}
+	return NULL;
+}
+
+// I2C error callback; runs in interrupt context once a transaction has used up its retries.
+// Keeps a record; the state machines carry on.
+static void i2c_error(i2c_transaction_t *pI2cTrans, enum_usi_i2c_errors_t err)
+{
+	gI2cErrCount++;
+	gI2cLastErr = err;
+	gI2cLastErrAddr = pI2cTrans->address & ~I2C_READ_BIT;
+}
+
+// Posts the backlight write; it goes out as soon as the bus is free without waking main() again.
+static int set_lcd_backlight(uint8_t state, i2c_transaction_t *i2c_trn)
+{
+	if (usi_i2c_post_pending())
+		return 0;												// Last write hasn't gone out yet; try again next pass.
+	lcd_set_backlight_int(state, i2c_trn);
+	return (usi_i2c_post(i2c_trn) == 0);
 }
 
 static inline int wait_for_usi_finish(i2c_transaction_t *i2c_trn)
@@ -478,88 +530,33 @@ static inline int wait_for_usi_finish(i2c_transaction_t *i2c_trn)
 
 
 /* ********************************************************************************************
- * drawNrmModeStaticData - Draws all of the static elements in Normal mode to the LCD display.
- * Follows the usual i2c callback function prototype call.
- * i2c_transaction_t *pI2cTrans: is a pointer to a i2c transaction struct.
- * void *userdata: is used as a pointer to the callback function.
+ * drawLayoutSM - Redraws the stale fields of the screen layout [see lcd_layout.h], a line write per field.
+ * Follows the usual i2c callback function prototype call; the job comes back here after each field and
+ * can give way to higher priority I2C jobs in between [putstr_to_lcd_int()].
+ * Fields whose values haven't been touched are skipped without being formatted.
 ** *******************************************************************************************/
-static void* drawNrmModeStaticData(i2c_transaction_t *pI2cTrans, void *userdata)
+static void* drawLayoutSM(i2c_transaction_t *pI2cTrans, void *userdata)
 {
-	static enum_display_norm_static_sm_t state = DISP_NORM_START;
-	static i2c_callback_fnptr_t myCallback = NULL;
+	(void)userdata;
 
-	switch(state)
+	if (!lcd_layout_next_field(gSysBuf))						// Nothing stale [a parked job can come back to find it drawn].
 	{
-	case DISP_NORM_START:
-		usi_i2c_get();												// Take the USI.
-		lcd_get();													// Take the LCD.
-		myCallback = (userdata == NULL) ? NULL : (i2c_callback_fnptr_t)userdata;
-		//Clear screen?
-		state = DISP_NORM_LINE1;
-		// If not clear screen then can probably fall through.
-		break;
-	case DISP_NORM_LINE1:
-		prep_str_for_lcd((uint8_t *)gSyncDispStr, 0x14, 0);
-		putstr_to_lcd_int(&gsI2Ctransact, drawNrmModeStaticData);	// Put the updated data to LCD line 1 and return control here when done.
-		state = DISP_NORM_LINE2;
-		break;
-	case DISP_NORM_LINE2:
-		prep_str_for_lcd((uint8_t *)gAsyncDispStr, 0x54, 0);
-		putstr_to_lcd_int(&gsI2Ctransact, drawNrmModeStaticData);	// Put the updated data to LCD line 2 and return control here when done.
-		state = DISP_NORM_END;
-		break;
-	case DISP_NORM_END:
-		if (myCallback != NULL)
-		{
-			pI2cTrans->callbackFn = myCallback;
-			usi_i2c_raise_event();									// Re-raise the I2C system event and keep the USI and LCD.
-		}
-		else
-		{
-			pI2cTrans->callbackFn = NULL;
-			usi_i2c_release();										// Release USI.
-			lcd_release();											// Release LCD.
-		}
-		state = DISP_NORM_START;									// Reset state machine.
+		pI2cTrans->callbackFn = NULL;
 		pI2cTrans->transactType = I2C_T_IDLE;
-		myCallback = NULL;
-		break;
+		usi_i2c_release();										// Release USI.
+		lcd_release();											// Release LCD.
+		return NULL;
 	}
-
+	pI2cTrans->buf = gSysBuf;
+	putstr_to_lcd_int(pI2cTrans, (lcd_layout_pending()) ? drawLayoutSM : NULL);	// The last field lets <putstr_to_lcd_int> clean up.
 	return NULL;
 }
 
-static inline void asyncEventSM(i2c_transaction_t *pI2cTrans)
-{
-	const uint8_t cursorPos = 0x54 + 7;		// Initial cursor position.
-	//static uint16_t asyncCount = 0xffff;
-
-	gSysBuf[0] = cursorPos | 0x80;
-	//((gSysFlags & SYSFLG_RENC_DIR) == 0) ? asyncCount-- : asyncCount++;
-	print_u16((uint8_t *)&gSysBuf[1], gAsyncCount, 5);
-	gSysBuf[SYS_BUF_SZ - 1] = '\0';				// Guarantee null terminated.  If there's a valid char in the last element of the array this will clobber it!
-	gSysFlags &= ~SYSFLG_ASYNCSYSEVENT;			// Clear the flag - the rest is handled by the I2C and display update state machines.
-												// This way we can capture the next event while we're processing this one.
-	putstr_to_lcd_int(pI2cTrans, NULL);
-}
-
-static inline void syncEventSM(i2c_transaction_t *pI2cTrans)
-{
-	const uint8_t cursorPos = 0x14 + 6;
-	//static uint16_t syncCount = 0;
-
-	gSysBuf[0] = cursorPos | 0x80;
-	//print_u16((uint8_t *)&gSysBuf[1], syncCount++, 5);
-	print_u16((uint8_t *)&gSysBuf[1], gSyncCount, 5);
-	gSysBuf[SYS_BUF_SZ - 1] = '\0';				// Guarantee null terminated.  If not careful when initially filling the array, will clobber the last value.
-	gSysFlags &= ~SYSFLG_SYNCSYSEVENT;			// Clear the flag - the rest is handled by the I2C and display update state machines.
-												// This way we can capture the next event while we're processing this one.
-	putstr_to_lcd_int(pI2cTrans, NULL);
-}
-
 static inline void* fetchRtcTime(i2c_transaction_t *pI2cTrans, void *userdata)
 {
 	static uint8_t state = 0;
+	uint8_t dom;
+	(void)userdata;
 
 	if (state == 0)
 	{
@@ -567,21 +564,25 @@ static inline void* fetchRtcTime(i2c_transaction_t *pI2cTrans, void *userdata)
 		lcd_get();												// Take the LCD.
 		pI2cTrans->buf = gSysBuf;
 		pI2cTrans->callbackFn = fetchRtcTime;
-		//ds3231m_get_time(pI2cTrans);
-		ds3231m_get_all(pI2cTrans);
+		ds3231m_get_time(pI2cTrans);
 		usi_i2c_txrx_start(pI2cTrans);
 		state = 1;
 	}
 	else
 	{
-		convert_array_to_datetime((uint8_t *)gSysBuf, &gDt, 1);	// Update the datetime structure with the RTC time.
 		pI2cTrans->callbackFn = NULL;
 		pI2cTrans->transactType = I2C_T_IDLE;
 		usi_i2c_release();										// Release USI.
 		lcd_release();											// Release LCD.
-		gSysFlags &= ~SYSFLG_FETCH_DATETIME;					// Clear the fetch datetime flag.
-		gSysFlags |= SYSFLG_DISP_DATETIME;						// Signal to the system that it's time to display an updated date and time.
 		state = 0;
+		if (usi_i2c_get_error() != USI_I2C_ERR_NONE)			// Nothing was read; keep counting and leave the fetch flag to retry.
+			return NULL;
+		dom = gDt.dom;
+		convert_array_to_datetime((uint8_t *)gSysBuf, &gDt, 1);	// Update the datetime structure with the RTC time.
+		gRtcSyncS = 0;
+		if (!(gSysFlags & SYSFLG_ONESEC_EVENT))					// An edge during the read may or may not be in it; read again after it.
+			gSysFlags &= ~SYSFLG_FETCH_DATETIME;				// Clear the fetch datetime flag.
+		lcd_layout_touch(LAYOUT_V_TIME | ((gDt.dom != dom) ? LAYOUT_V_DATE : 0));	// The date line only when the day has moved on.
 	}
 
 	return NULL;
@@ -590,6 +591,7 @@ static inline void* fetchRtcTime(i2c_transaction_t *pI2cTrans, void *userdata)
 static inline void* setRtcTime(i2c_transaction_t* pI2cTrans, void* userData)
 {
 	static uint8_t state = 0;
+	(void)userData;
 
 	if (state == 0)
 	{
@@ -608,90 +610,13 @@ static inline void* setRtcTime(i2c_transaction_t* pI2cTrans, void* userData)
 		usi_i2c_release();										// Release USI.
 		lcd_release();											// Release LCD.
 		gSysFlags &= ~SYSFLG_SET_RTC_DATETIME;					// Clear the set RTC flag.
+		gSysFlags |= SYSFLG_FETCH_DATETIME;						// Read back what the RTC took; the count carries on from it.
 		state = 0;
 	}
 
 	return NULL;
 }
 
-static inline void* displayRtcDataSM(i2c_transaction_t *pI2cTrans, void *userdata)
-{
-	static uint8_t state = 0;
-
-	if (state == 0)										// Display the date.
-	{
-		usi_i2c_get();									// Take the USI.
-		lcd_get();										// Take the LCD.
-		pI2cTrans->callbackFn = displayRtcDataSM;		// Set the I2C callback to this function.
-		pI2cTrans->buf = gSysBuf;						// Reset the buffer pointer.
-		gSysBuf[0] = 0x80 | gLcdRowOffsets[0];			// LCD line 1
-		convert_datetime_to_bcd(&gDt);					// Require the datetime struct to be in BCD format for display.
-		prep_date_disp_str(&gDt, (uint8_t *)&gSysBuf[1]);
-		state = 1;
-		putstr_to_lcd_int(pI2cTrans, displayRtcDataSM);
-	}
-	else												// Display the time.
-	{
-		pI2cTrans->buf = gSysBuf;						// Reset the buffer pointer.
-		gSysBuf[0] = 0x80 | gLcdRowOffsets[1];			// LCD line 2
-		prep_time_disp_str(&gDt, (uint8_t *)&gSysBuf[1]);
-		state = 0;
-		putstr_to_lcd_int(pI2cTrans, NULL);				// Let <putstr_to_lcd_int> clean up [saves a call]; it will release the USI and the LCD, and set the I2C callback=NULL.
-		gSysFlags &= ~SYSFLG_DISP_DATETIME;				// Clear the display update system flag.
-	}
-
-	return NULL;
-}
-
-/*  This is the old display function.
-static inline void* displayRtcDataSM(i2c_transaction_t *pI2cTrans, void *userdata)
-{
-	static rtc_display_sm_t state = RTC_GET_TIME;
-
-	//if necessary, override the time update here.
-
-	switch(state)
-	{
-	case RTC_GET_TIME:
-		usi_i2c_get();									// Take the USI.
-		lcd_get();										// Take the LCD.
-		gSysFlags &= ~SYSFLG_FETCH_DATETIME;
-		pI2cTrans->buf = gSysBuf;
-		pI2cTrans->callbackFn = displayRtcDataSM;
-		//ds3231m_get_time(pI2cTrans);
-		ds3231m_get_all(pI2cTrans);
-		state = RTC_DIS_DATE;
-		usi_i2c_txrx_start(pI2cTrans);
-		break;
-	case RTC_DIS_DATE:
-		convert_array_to_datetime((uint8_t *)gSysBuf, &gDt, 1);
-		pI2cTrans->buf = gSysBuf;						// Reset the buffer pointer.
-		gSysBuf[0] = 0x80 | gLcdRowOffsets[0];			// LCD line 1
-		prep_date_disp_str(&gDt, (uint8_t *)&gSysBuf[1]);
-		state = RTC_DIS_TIME;
-		putstr_to_lcd_int(pI2cTrans, displayRtcDataSM);
-		break;
-	case RTC_DIS_TIME:
-		pI2cTrans->buf = gSysBuf;						// Reset the buffer pointer.
-		gSysBuf[0] = 0x80 | gLcdRowOffsets[1];			// LCD line 2
-		prep_time_disp_str(&gDt, (uint8_t *)&gSysBuf[1]);
-		state = RTC_GET_TIME;							// Let <putstr_to_lcd_int> clean up [saves a call].
-		putstr_to_lcd_int(pI2cTrans, NULL);
-		break;
-	//case RTC_DIS_END:
-		// If we didn't want <put_to_lcd_int> to clean up then we could clean up here.
-	//default:											// Should never get here. [only if not cleaning up in this function].
-	//	pI2cTrans->callbackFn = NULL;
-	//	pI2cTrans->transactType = I2C_T_IDLE;
-	//	usi_i2c_release();								// Release USI.
-	//	lcd_release();									// Release LCD.
-	//	state = RTC_GET_TIME;
-	//	break;
-	}
-	return NULL;
-} */
-
-
 /* *****************************************************************************************************************************************************
  * static void* putstr_to_lcd_int(i2c_transaction_t *i2c_trn, void *userdata)
  * i2c_transaction_t *i2c_trn: is a pointer to an i2c_transaction_t struct and will hold all of the transaction data.
@@ -699,70 +624,58 @@ static inline void* displayRtcDataSM(i2c_transaction_t *pI2cTrans, void *userdat
  * 				   It is not typed so beware when typecasting!
  *
  * This function puts a string to the LCD for display.  The string must be null terminated.
- * This function may be called with a callback; in this case, when the string send is finished this routine will issue a STOP to I2C and register the
- * callback in the I2C struct.  When the processor wakes because of the I2C event it will follow the callback.
+ * This function may be called with a callback; in this case, when the string send is finished this routine will
+ * register the callback in the I2C struct.  When the processor wakes because of the I2C event it will follow the callback.
  *
- * Requires that the buffer in the i2c struct be filled with the data to send.  It also requires a 'helper' 4-byte buffer to hold data.
+ * Requires that gSysBuf be filled with the data to send.
  * The first element of the buffer must be the cursor position to display the first character of the string.
  * The next elements of the buffer are the characters to display [sequentially] on the LCD.
  * The string must be null terminated or bad things will happen.
+ *
+ * The whole line [expander register, cursor command and string] goes out as one scatter-gather I2C transaction
+ * [gLcdLineSegs]; the ISR does the bus encoding on the fly so main() is only woken once.
+ *
+ * A 20 character line on the MCP23008 at LCD_I2C_CLK_DIV, from the host bench [sim/, "lcd line [20 chars]"];
+ * 88 bus bytes with the RS writes:
+ * 	scatter-gather:						266 USI interrupts, 1536us, 1 wakeup.
+ * 	per character TX_WAIT [original]:	22 wakeups, SCL held low for a main() round trip between every character.
+ * Build with DBG_LCD_LINE_TIMING = 1 to measure ticks and wakeups per line on the target.
  **************************************************************************************************************************************************** */
 static void* putstr_to_lcd_int(i2c_transaction_t *i2c_trn, void *userdata)
 {
-	// Consider allowing *userdata to be a callback function pointer.
-	// This function will need to implement a static variable to store the callback.
-	// This will allow multiline screen updates to happen without interruption [such as date and time display].
 	static enum_lcd_print_sm_t state = LCD_P_SM_SEND_START;
-	static uint8_t bufIndx = 0;
 	static i2c_callback_fnptr_t myCallback = NULL;
+#if DBG_LCD_LINE_TIMING == 1
+	static uint16_t startTicks;
+
+	gLcdLineWakes++;
+#endif
 
 	switch(state)
 	{
 	case LCD_P_SM_SEND_START:
 		usi_i2c_get();									// Take the USI.  <-- Might not be necessary; the caller should have already taken care of this.
 		lcd_get();										// Take the LCD.  <-- See above.
+#if DBG_LCD_LINE_TIMING == 1
+		startTicks = TA0R;
+		gLcdLineWakes = 0;
+#endif
 		myCallback = (userdata == NULL) ? NULL : (i2c_callback_fnptr_t)userdata;
-		bufIndx = 0;
-		gTmpBuf[0] = IO_EXP_IO_REG;
 		i2c_trn->address = IO_EXPANDER_ADDR;
-		i2c_trn->numBytes = 1;
+		i2c_trn->clkDiv = LCD_I2C_CLK_DIV;
 		i2c_trn->callbackFn = putstr_to_lcd_int;
-		i2c_trn->buf = gTmpBuf;
-		i2c_trn->transactType = I2C_T_TX_WAIT;
-		state = LCD_P_SM_SEND_CURS;
+		i2c_trn->flags = I2C_TF_SG;
+		i2c_trn->segs = gLcdLineSegs;
+		i2c_trn->transactType = I2C_T_TX_STOP;
+		state = LCD_P_SM_END;
 		usi_i2c_txrx_start(i2c_trn);
 		break;
-	case LCD_P_SM_SEND_CURS:
-		i2c_trn->buf = gTmpBuf;
-		i2c_trn->numBytes = 4;
-		i2c_trn->transactType = I2C_T_TX_WAIT;
-		lcd_write_int(gSysBuf[bufIndx++], 1, 0, gTmpBuf);
-		state = LCD_P_SM_SEND_CHAR;
-		usi_i2c_txrx_resume();
-		break;
-	case LCD_P_SM_SEND_CHAR:
-		if (gSysBuf[bufIndx])
-		{
-			lcd_write_int(gSysBuf[bufIndx++], 1, 1, gTmpBuf);
-			i2c_trn->buf = gTmpBuf;
-			i2c_trn->numBytes = 4;
-
-			if (gSysBuf[bufIndx] == (uint8_t)'\0')// Look ahead for null termination.
-			{									// If the next char is null then the transaction can end after this.
-				i2c_trn->transactType = I2C_T_TX_STOP;
-				state = LCD_P_SM_END;
-			}
-			usi_i2c_txrx_resume();
-		}
-		else									// This will likely never get executed, but it's safer if we somehow miss the null termination in the previous block.
-		{
-			i2c_trn->transactType = I2C_T_TX_STOP;
-			state = LCD_P_SM_END;
-			usi_i2c_txrx_stop(i2c_trn);
-		}
-		break;
 	case LCD_P_SM_END:
-		if (myCallback != NULL)
+#if DBG_LCD_LINE_TIMING == 1
+		gLcdLineTicks = TA0R - startTicks;
+#endif
+		i2c_trn->flags = 0;
+		if ( (myCallback != NULL) && !i2c_arb_yield(myCallback) )	// Carry on unless higher priority work takes the bus first.
 		{
 			i2c_trn->callbackFn = myCallback;
 			usi_i2c_raise_event();				// Re-raise the I2C system event and keep the USI and LCD.
@@ -777,14 +690,6 @@ static void* putstr_to_lcd_int(i2c_transaction_t *i2c_trn, void *userdata)
 		i2c_trn->transactType = I2C_T_IDLE;
 		myCallback = NULL;
 		break;
-	/*default:									// Clean up here.  Will also reset everything if things have gone nuts.
-		i2c_trn->callbackFn = NULL;
-		usi_i2c_release();						// Release USI.
-		lcd_release();							// Release LCD.
-		state = LCD_P_SM_SEND_START;			// Reset state machine.
-		i2c_trn->transactType = I2C_T_IDLE;
-		myCallback = NULL;
-		break;*/
 	}
 	return NULL;
 }
@@ -801,7 +706,7 @@ static void* putstr_to_lcd_int(i2c_transaction_t *i2c_trn, void *userdata)
  * step 0: keep track of the variable that we need to update [and the final desired cursor position?]
  * step 1: Update the proper field in the datetime struct.
  * step 2: Turn off cursor blinking.
- * step 3: Set SYSFLG_DISP_DATETIME to direct the system to display the updated date & time.
+ * step 3: Touch the date and time in the screen layout to display the updated date & time.
  *         - or -
  *         Call the screen update directly so we can pass our function as the
  *         callback and get back into our state machine to reset the cursor position and to
@@ -813,46 +718,26 @@ static void* putstr_to_lcd_int(i2c_transaction_t *i2c_trn, void *userdata)
  * step 4: Direct the system to update the RTC with the new date and time.  Exit config
  *         mode.
  ***************************************************************************************** */
-static inline void changeDateTimeUiSM(void)
+static void changeDateTimeUiSM(void)
 {
-	// Declaration of a constant function pointer table:
-	//const uint8_t (* const fnTbl[])(DateTime_t *, int8_t) = {change_day_of_week, change_day_of_month, change_month, change_year, change_hour, change_minute, change_second};
+	// The gDt field each state edits [change_field()].
+	static const uint8_t fields[] = {	offsetof(DateTime_t, dow),		// UI_UPD_S_DAY
+										offsetof(DateTime_t, dom),		// UI_UPD_S_DATE
+										offsetof(DateTime_t, month),	// UI_UPD_S_MONTH
+										offsetof(DateTime_t, year),		// UI_UPD_S_YEAR
+										offsetof(DateTime_t, hours),	// UI_UPD_S_HOUR
+										offsetof(DateTime_t, minutes),	// UI_UPD_S_MIN
+										offsetof(DateTime_t, seconds) };	// UI_UPD_S_SEC
 	static ui_dt_upd_sm_t state = UI_UPD_S_DAY;
-	static uint8_t (*fp)(DateTime_t *, int8_t) = NULL;	// Pointer to a function that returns uint8_t
-														// and takes DateTime_t * and uint8_t args.
-	// Set the cursor to the right spot.
-	switch (state)										// In this switch set the function pointer to the appropriate ui_update function.
-	{
-	case UI_UPD_S_DAY:
-		fp = change_day_of_week;
-		break;
-	case UI_UPD_S_DATE:
-		fp = change_day_of_month;
-		break;
-	case UI_UPD_S_MONTH:
-		fp = change_month;
-		break;
-	case UI_UPD_S_YEAR:
-		fp = change_year;
-		break;
-	case UI_UPD_S_HOUR:
-		fp = change_hour;
-		break;
-	case UI_UPD_S_MIN:
-		fp = change_minute;
-		break;
-	case UI_UPD_S_SEC:
-		fp = change_second;
-		break;
-	}
 
 	if (gSysFlags & SYSFLG_RENC_BTN_LNG)		// long press - abort the ui update.
 	{
 		state = UI_UPD_S_DAY;
 		gSysFlags &= ~(SYSFLG_RENC_BTN_LNG | SYSFLG_CONFIG_MODE);
 		gSysFlags |= (SYSFLG_FETCH_DATETIME);	// Flag the system to fetch the time from the RTC.  The time fetch will trigger a screen repaint.
+		lcd_layout_touch(LAYOUT_V_DATE);		// The fetch only redraws the date if the day differs; the edited one may not.
 	}
-	else if (gSysFlags & SYSFLG_RENC_BTN_SHRT)	// short press - advance the state [which will move the current function pointer].
+	else if (gSysFlags & SYSFLG_RENC_BTN_SHRT)	// short press - advance the state [which will move on to the next field].
 	{
 		if (state < UI_UPD_S_SEC)				// Not at the last state, update the state.
 		{
@@ -867,13 +752,10 @@ static inline void changeDateTimeUiSM(void)
 	}
 	else if (gSysFlags & SYSFLG_RENC_ROT_EVENT)	// Rotary encoder event detected; increment or decrement the variable to be modified.
 	{
-		if (gSysFlags & SYSFLG_RENC_DIR)
-			fp(&gDt, 1);
-		else
-			fp(&gDt, 0);
+		change_field(&gDt, fields[state], (gSysFlags & SYSFLG_RENC_DIR) ? 1 : 0);
 
 		gSysFlags &= ~SYSFLG_RENC_ROT_EVENT;
-		gSysFlags |= SYSFLG_DISP_DATETIME;		// Flag to update the datetime on the screen.
+		lcd_layout_touch(LAYOUT_V_DATE | LAYOUT_V_TIME);	// Update the datetime on the screen.
 	}
 	else
 	{
@@ -881,79 +763,6 @@ static inline void changeDateTimeUiSM(void)
 	}
 }
 
-static int prep_str_for_lcd(uint8_t *theStr, uint8_t pos, uint8_t sz)
-{
-	gSysBuf[0] = pos | 0x80;
-
-	if (sz)												// Number of characters is specified.
-		memcpy((uint8_t *)&gSysBuf[1], theStr, sz);
-	else												// Or NUL terminated string.
-		strcpy((char *)&gSysBuf[1], (const char *)theStr);
-
-	return 1;
-}
-
-
-uint8_t* itoa(int16_t value, uint8_t *result, uint8_t base)
-{
-	// check that the base is valid
-	if ( (base < 2) || (base > 16) )
-	{
-		*result = '\0';
-		return result;
-	}
-
-	uint8_t* ptr = result, *ptr1 = result, tmp_char;
-	int16_t tmp_value;
-
-	do
-	{
-		tmp_value = value;
-		value /= base;
-		*ptr++ = "fedcba9876543210123456789abcdef" [15 + (tmp_value - value * base)];
-	} while (value);
-
-	// Apply negative sign
-	if (tmp_value < 0) *ptr++ = '-';
-	*ptr-- = '\0';
-	while(ptr1 < ptr)
-	{
-		tmp_char = *ptr;
-		*ptr--= *ptr1;
-		*ptr1++ = tmp_char;
-	}
-	return result;
-}
-
-uint8_t* utoa(uint16_t value, uint8_t *result, uint8_t base)
-{
-	// check that the base is valid
-	if ( (base < 2) || (base > 36) )
-	{
-		*result = '\0';
-		return result;
-	}
-
-	uint8_t* ptr = result, *ptr1 = result, tmp_char;
-	uint16_t n, tmp_value;
-
-	do
-	{
-		tmp_value = value;
-		value /= base;
-		n = (tmp_value - value * base);
-		*ptr++ = (n < 10)? '0' + n: ('a' - 10) + n;	//lowercase only.
-	} while (value);
-
-	*ptr-- = '\0';
-	while(ptr1 < ptr)
-	{
-		tmp_char = *ptr;
-		*ptr--= *ptr1;
-		*ptr1++ = tmp_char;
-	}
-	return result;
-}
 
 // Prints an input uint16_t value in an arbitrary width field.
 // Ensures that when decrementing numbers over a magnitude boundary
@@ -962,44 +771,53 @@ uint8_t* utoa(uint16_t value, uint8_t *result, uint8_t base)
 // The 'empty' digits are filled with ASCII space.
 static uint8_t* print_u16(uint8_t *buf, uint16_t value, uint8_t width)
 {
-	register uint8_t indx = 0;
+	uint8_t digits[5];
+	uint8_t n = 0, indx = 0;
 
-	utoa(value, buf, 10);						// Convert number to null-terminated ascii string.
-	while (buf[indx++]);						// Find the null termination.
-	memset(&buf[--indx], 0x20, width - indx);	// Fill rest with ASCII space.
+	do											// Decimal digits, least significant first.
+	{
+		digits[n++] = (value % 10) + ASCII_ZERO;
+		value /= 10;
+	} while (value);
+	while (n)
+		buf[indx++] = digits[--n];
+	memset(&buf[indx], 0x20, width - indx);		// Fill rest with ASCII space.
 	buf[width] = '\0';							// Ensure null termination.
 	return buf;
 }
 
-static inline void prep_time_disp_str(DateTime_t *dt, uint8_t *buf)
+// Two digits of a DateTime_t field [BCD if 'bcd', else binary], then 'delimiter'; returns where the next field goes.
+static uint8_t* put_digits(uint8_t *buf, uint8_t value, uint8_t bcd, uint8_t delimiter)
 {
-	// Assumes dt is in BCD format.
+	if (!bcd)
+		value = decToBcd8(value);
+	buf[0] = (value >> 4) + ASCII_ZERO;
+	buf[1] = (value & 0x0f) + ASCII_ZERO;
+	buf[2] = delimiter;
+	return &buf[3];
+}
+
+static inline void prep_time_disp_str(const DateTime_t *dt, uint8_t *buf)
+{
+	const uint8_t *field = &dt->hours;				// Hours, minutes and seconds go down through the struct.
+	uint8_t n;
+
+	// dt in either format; it's left as it is.
 	// Display format is HH:MM:SS  [24hr]
-	buf[0] = ((dt->hours >> 4) & 0x0f) + ASCII_ZERO;
-	buf[1] = (dt->hours & 0x0f) + ASCII_ZERO;
-	buf[2] = TIME_DELIMITER;
-	buf[3] = ((dt->minutes >> 4) & 0x0f) + ASCII_ZERO;
-	buf[4] = (dt->minutes & 0x0f) + ASCII_ZERO;
-	buf[5] = TIME_DELIMITER;
-	buf[6] = ((dt->seconds >> 4) & 0x0f) + ASCII_ZERO;
-	buf[7] = (dt->seconds & 0x0f) + ASCII_ZERO;
-	buf[8] = '\0';	//NUL string terminator.
+	for (n = 0; n < 3; n++)
+		buf = put_digits(buf, field[-n], dt->bcd_format, (n < 2) ? TIME_DELIMITER : '\0');	//NUL string terminator.
 }
 
-static inline void prep_date_disp_str(DateTime_t *dt, uint8_t *buf)
+static inline void prep_date_disp_str(const DateTime_t *dt, uint8_t *buf)
 {
-	// Assumes dt is in BCD format.
+	// dt in either format; dow and month are the same in both.
 	// This displays "DOW DD/MMM/YY"
 	memcpy(&buf[0], gDaysOfWeek[(uint8_t)(dt->dow - 1)], 3);
 	buf[3] = ' ';
-	buf[4] = ((dt->dom >> 4) & 0x0f) + ASCII_ZERO;
-	buf[5] = (dt->dom & 0x0f) + ASCII_ZERO;
-	buf[6] = DATE_DELIMITER;
+	put_digits(&buf[4], dt->dom, dt->bcd_format, DATE_DELIMITER);
 	memcpy(&buf[7], gMonths[(uint8_t)(dt->month - 1)], 3);
 	buf[10] = DATE_DELIMITER;
-	buf[11] = ((dt->year >> 4) & 0x0f) + ASCII_ZERO;
-	buf[12] = (dt->year & 0x0f) + ASCII_ZERO;
-	buf[13] = '\0';	//NUL string terminator.
+	put_digits(&buf[11], dt->year, dt->bcd_format, '\0');	//NUL string terminator.
 
 	// This displays "YY/MMM/DD DOW" <-- Makes it easier in UI to filter for invalid month/day combinations.
 	/*buf[0] = ((dt->year >> 4) & 0x0f) + ASCII_ZERO;
@@ -1014,6 +832,39 @@ static inline void prep_date_disp_str(DateTime_t *dt, uint8_t *buf)
 	buf[13] = '\0'; */
 }
 
+// Screen layout formatters [lcd_layout_fmt_fnptr_t].
+// A NUL terminated label, padded with spaces to the field width.
+static void fmt_text(uint8_t *buf, uint8_t width, const void *arg)
+{
+	uint8_t n = strlen((const char *)arg);
+
+	if (n > width)
+		n = width;
+	memcpy(buf, arg, n);
+	memset(&buf[n], ASCII_SPACE, width - n);
+}
+
+// A uint16_t, left aligned.
+static void fmt_u16(uint8_t *buf, uint8_t width, const void *arg)
+{
+	print_u16(buf, *(const uint16_t *)arg, width);
+}
+
+// "DOW DD/MMM/YY" from a DateTime_t; 13 wide.  The clock itself is left in its own format.
+static void fmt_date(uint8_t *buf, uint8_t width, const void *arg)
+{
+	(void)width;
+	prep_date_disp_str((const DateTime_t *)arg, buf);
+}
+
+// "HH:MM:SS" from a DateTime_t; 8 wide.
+static void fmt_time(uint8_t *buf, uint8_t width, const void *arg)
+{
+	(void)width;
+	prep_time_disp_str((const DateTime_t *)arg, buf);
+}
+
+
 
 // #########################
 // Interrupt Routine Definitions
@@ -1052,33 +903,36 @@ __interrupt void PORT2_ISR(void)
 	const uint8_t cw_seq = 0x87;
 	const uint8_t ccw_seq = 0x4b;
 	static uint8_t state = 0;
-	int wake;
+	int wake = 0;
 
-	// This really requires [at least minimal] hw debounce or it doesn't work at all.
-	// 0.1uF ceramic capacitors + internal port pullups used - seems to work well.
-	// Note that if sigB != Px.1 and sigA != Px.0 then shifts need to be incorporated.
-	state |= P2IN & (RENC_SIGB | RENC_SIGA);
-	if (state == cw_seq)
+	if (P2IFG & (RENC_SIGB | RENC_SIGA))
 	{
-		gSysFlags |= (SYSFLG_RENC_ROT_EVENT | SYSFLG_RENC_DIR);
-		wake = 1;
-	}
-	else if (state == ccw_seq)
-	{
-		gSysFlags = (gSysFlags | SYSFLG_RENC_ROT_EVENT) & ~SYSFLG_RENC_DIR;
-		wake = 1;
-	}
-	state <<= 2;
+		// This really requires [at least minimal] hw debounce or it doesn't work at all.
+		// 0.1uF ceramic capacitors + internal port pullups used - seems to work well.
+		// Note that if sigB != Px.1 and sigA != Px.0 then shifts need to be incorporated.
+		state |= P2IN & (RENC_SIGB | RENC_SIGA);
+		if (state == cw_seq)
+		{
+			gSysFlags |= (SYSFLG_RENC_ROT_EVENT | SYSFLG_RENC_DIR | SYSFLG_USER_ACTIVITY);
+			wake = 1;
+		}
+		else if (state == ccw_seq)
+		{
+			gSysFlags = (gSysFlags | SYSFLG_RENC_ROT_EVENT | SYSFLG_USER_ACTIVITY) & ~SYSFLG_RENC_DIR;
+			wake = 1;
+		}
+		state <<= 2;
 
-	if (P2IFG & RENC_SIGA)
-	{
-		P2IES ^= RENC_SIGA;
-		P2IFG &= ~RENC_SIGA;
-	}
-	else if (P2IFG & RENC_SIGB)
-	{
-		P2IES ^= RENC_SIGB;
-		P2IFG &= ~RENC_SIGB;
+		if (P2IFG & RENC_SIGA)
+		{
+			P2IES ^= RENC_SIGA;
+			P2IFG &= ~RENC_SIGA;
+		}
+		else if (P2IFG & RENC_SIGB)
+		{
+			P2IES ^= RENC_SIGB;
+			P2IFG &= ~RENC_SIGB;
+		}
 	}
 
 	if (wake)
@@ -1147,7 +1001,7 @@ __interrupt void TIMER0_A0_ISR(void)
 
 		if (flag)
 		{
-			gSysFlags &= ~SYSFLG_RENC_BTN_DN;			// Cancel the rotary encoder button down flag.
+			gSysFlags = (gSysFlags & ~SYSFLG_RENC_BTN_DN) | SYSFLG_USER_ACTIVITY;	// Cancel the rotary encoder button down flag.
 			rencBtnTimer = 0;							// Reset the button down timer since we've detected either a long or short press.
 			P1IFG &= ~RENC_BTN;							// Clear the button interrupt flag (might be set from bounce).
 			P1IE |= RENC_BTN;							// Turn the button interrupt back on.
@@ -1155,6 +1009,9 @@ __interrupt void TIMER0_A0_ISR(void)
 		}
 	}
 
+	if (bl_tick())										// Backlight fade; wake to turn the display off once it's out.
+		wake = 1;
+
 	if (--syncEventCounter == 0)
 	{
 		syncEventCounter = SYNC_EVENT_COUNTER;			// Reload the synchronous event counter.
@@ -1165,3 +1022,29 @@ __interrupt void TIMER0_A0_ISR(void)
 	if (wake)
 		__bic_SR_register_on_exit(SLEEP_MODE);
 }
+
+// Timer_A0 CCR1, CCR2 and overflow.
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void TIMER0_A1_ISR(void)
+{
+	int wake = 0;
+
+	switch (__even_in_range(TA0IV, TA0IV_TAIFG))
+	{
+	case TA0IV_TACCR1:									// LCD init delays, then the backlight PWM.
+		wake = (bl_pwm_active()) ? bl_pwm_tick() : lcd_init_tick();
+		break;
+
+	case TA0IV_TACCR2:									// I2C bus watchdog.
+#if USI_I2C_WDT == 1
+		wake = usi_i2c_wdt_tick();
+#endif
+		break;
+
+	default:
+		break;
+	}
+
+	if (wake)
+		__bic_SR_register_on_exit(SLEEP_MODE);
+}
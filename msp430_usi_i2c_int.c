@@ -7,6 +7,7 @@
  *  This is an interrupt driven implementation of an I2C master for the MSP430 USI module!
  */
 
+#include <string.h>
 #include "msp430_usi_i2c_int.h"
 
 // #########################
@@ -26,6 +27,7 @@ static inline void stop(void);
 static inline void prep_ack_nack(void);
 static inline int get_ack_nack(void);
 static inline void send_ack_nack(int nack);
+static inline int bus_check(void);
 
 // #########################
 // Global Variables
@@ -34,6 +36,64 @@ static inline void send_ack_nack(int nack);
 static volatile usi_i2c_sys_info_t	usi_i2c_sys_info;
 static volatile i2c_transaction_t	*i2c_transact;
 
+// ISR state and the plan for the transaction on the bus [see plan_transaction()].
+// The states are enum_i2c_state_t kept in a byte; an enum variable takes an int.
+static volatile uint8_t				i2c_state = I2C_S_START;
+static volatile uint8_t				*i2c_buf;				// Working copies of the descriptor's buf and numBytes.
+static uint8_t						i2c_count;
+static uint8_t						i2c_data_state;			// TX_BYTE, TX_BYTE_SG or RX_BYTE.
+static uint8_t						i2c_after_last;			// Where to go once i2c_count runs out.
+static uint8_t						i2c_stop_next;			// STOP, or PAUSE for a repeated start.
+static uint8_t						i2c_resume_state;		// Where usi_i2c_txrx_resume() picks up after a PAUSE.
+static uint8_t						i2c_last_nack;			// N/ACK for the last received byte.
+static uint8_t						i2c_clk_div;			// USIDIV bits given to usi_i2c_master_init().
+
+// Per transaction type decisions, indexed by enum_i2c_transact_type_t.
+typedef struct
+{
+	enum_i2c_state_t	afterLast;
+	enum_i2c_state_t	stopNext;
+	uint8_t				lastNack;
+	uint8_t				resumeData;		// 1: resume into the data state after a pause, 0: resume with a [repeated] start.
+} i2c_plan_t;
+
+static const i2c_plan_t i2c_plan_tbl[] =
+{
+	/* I2C_T_IDLE		*/	{ I2C_S_PREP_STOP,	I2C_S_STOP,		0xff,	0 },
+	/* I2C_T_TX_STOP	*/	{ I2C_S_PREP_STOP,	I2C_S_STOP,		0xff,	0 },
+	/* I2C_T_RX_STOP	*/	{ I2C_S_PREP_STOP,	I2C_S_STOP,		0xff,	0 },
+	/* I2C_T_TX_WAIT	*/	{ I2C_S_PAUSE,		I2C_S_STOP,		0x00,	1 },
+	/* I2C_T_RX_WAIT	*/	{ I2C_S_PAUSE,		I2C_S_STOP,		0x00,	1 },
+	/* I2C_T_TX_RESTART	*/	{ I2C_S_PREP_STOP,	I2C_S_PAUSE,	0xff,	0 },
+	/* I2C_T_RX_RESTART	*/	{ I2C_S_PREP_STOP,	I2C_S_PAUSE,	0xff,	0 },
+	/* I2C_T_RX_RNDM	*/	{ I2C_S_PREP_STOP,	I2C_S_RNDM_RX,	0xff,	0 }		// Write half; I2C_S_RNDM_RX sets up the read half.
+};
+
+// The posted transaction [usi_i2c_post()], NULL if the slot is free.  The descriptor itself belongs to the caller.
+// It owns the USI while i2c_transact points at it.
+static i2c_transaction_t * volatile	i2c_post;
+
+// Scatter-gather transmit cursor.
+static const i2c_segment_t			*sg_seg;
+static const volatile uint8_t		*sg_src;
+static uint8_t						sg_left;
+static uint8_t						sg_phase;
+
+// Error handling.
+static i2c_error_fnptr_t			i2c_error_fn;
+static const i2c_retry_policy_t		*i2c_retry_policy;
+static uint8_t						i2c_retries_used;		// Retries taken by the transaction on the bus.
+static uint8_t						i2c_bus_cleared;		// bus_check() has already cleared the bus for this attempt.
+static uint8_t						i2c_rndm_reg;			// I2C_T_RX_RNDM register pointer; the read half overwrites buf[0].
+
+#if USI_I2C_WDT == 1
+static volatile uint8_t				i2c_wdt_progress;		// Bumped by the ISR as the transaction moves along.
+static uint8_t						i2c_wdt_seen;			// i2c_wdt_progress at the last watchdog tick.
+#define WDT_KICK()					i2c_wdt_progress++
+#else
+#define WDT_KICK()
+#endif
+
 // #########################
 // Function Definitions
 
@@ -106,6 +166,233 @@ static inline void set_error(enum_usi_i2c_errors_t theError)
 {
 	usi_i2c_sys_info.error = (enum_usi_i2c_errors_t)((usi_i2c_sys_info.error & 0xf0) | theError);
 }
+
+static inline void sg_begin(const i2c_segment_t *segs)
+{
+	sg_seg = segs;
+	sg_src = segs->buf;
+	sg_left = segs->len;
+	sg_phase = 0;
+}
+
+// Next byte of a scatter-gather transmit.  The driver has already checked that the list holds numBytes bytes.
+static inline uint8_t sg_next_byte(void)
+{
+	uint8_t data;
+
+	while ( (sg_seg->len == 0) ? (*sg_src == '\0') : (sg_left == 0) )	// Done with this segment; on to the next.
+		sg_begin(sg_seg + 1);
+
+	data = (sg_seg->xform == NULL) ? *sg_src : sg_seg->xform(*sg_src, sg_phase);
+	if (++sg_phase >= sg_seg->reps)
+	{
+		sg_phase = 0;
+		sg_src++;
+		sg_left--;
+	}
+	return data;
+}
+
+// Work out how many bytes a segment list puts on the bus.  Returns 0 if it won't fit a transaction.
+static uint8_t sg_length(const i2c_segment_t *segs)
+{
+	uint16_t total = 0;
+	uint8_t len;
+
+	for (; segs->buf != NULL; segs++)
+	{
+		len = (segs->len == 0) ? strlen((const char *)segs->buf) : segs->len;
+		total += (uint16_t)len * ((segs->reps == 0) ? 1 : segs->reps);
+	}
+	return (total > 0xff) ? 0 : (uint8_t)total;
+}
+
+// Load the type dependent part of the plan.  Also used when main() changes the type before resuming.
+static inline void load_plan(void)
+{
+	const i2c_plan_t *plan = &i2c_plan_tbl[i2c_transact->transactType];
+
+	i2c_after_last = plan->afterLast;
+	i2c_stop_next = plan->stopNext;
+	i2c_last_nack = plan->lastNack;
+	i2c_resume_state = (plan->resumeData) ? i2c_data_state : I2C_S_START;
+}
+
+// Work out everything the per-byte states need for this transaction.  Called at I2C_S_START.
+static inline void plan_transaction(void)
+{
+	i2c_buf = i2c_transact->buf;
+	i2c_count = i2c_transact->numBytes;
+	if (i2c_transact->address & I2C_READ_BIT)
+		i2c_data_state = I2C_S_RX_BYTE;
+	else if (i2c_transact->flags & I2C_TF_SG)
+	{
+		sg_begin(i2c_transact->segs);
+		i2c_data_state = I2C_S_TX_BYTE_SG;
+	}
+	else
+		i2c_data_state = I2C_S_TX_BYTE;
+	load_plan();
+	if (i2c_transact->transactType == I2C_T_RX_RNDM)
+	{
+		i2c_count = 1;								// Just the register pointer on the way out.
+		i2c_rndm_reg = i2c_buf[0];
+	}
+}
+
+// Switch SCL to the transaction's rate.  Only called at I2C_S_START, with SCL high and no count loaded, so nothing is mid bit.
+static inline void set_clock(uint8_t clkDiv)
+{
+	if (clkDiv == I2C_CLK_DEFAULT)
+		clkDiv = i2c_clk_div;
+	if ( (USICKCTL & I2C_CLK_DIV_MASK) != clkDiv )
+		USICKCTL = (USICKCTL & ~I2C_CLK_DIV_MASK) | clkDiv;
+}
+
+// Start watching the transaction [again].  Called whenever the USI interrupt is turned on.
+static inline void watch_start(void)
+{
+#if USI_I2C_WDT == 1
+	i2c_wdt_seen = i2c_wdt_progress - 1;			// The first tick always sees progress; gives a full period.
+	USI_I2C_WDT_CCR = TA0R + USI_I2C_WDT_TICKS;
+	USI_I2C_WDT_CCTL = CCIE;
+#endif
+}
+
+// Run the failed transaction again if its device's policy allows.  Returns 1 if it's been restarted.
+static inline int retry_transaction(void)
+{
+	const i2c_retry_policy_t *policy;
+
+	if ( (i2c_transact->transactType != I2C_T_TX_STOP) && (i2c_transact->transactType != I2C_T_RX_STOP) &&
+		 (i2c_transact->transactType != I2C_T_RX_RNDM) )
+		return 0;
+	for (policy = i2c_retry_policy; (policy != NULL) && (policy->address != 0); policy++)
+	{
+		if ( policy->address == (i2c_transact->address & ~I2C_READ_BIT) )
+		{
+			if (i2c_retries_used >= policy->retries)
+				return 0;
+			i2c_retries_used++;
+			if (i2c_transact->transactType == I2C_T_RX_RNDM)
+				i2c_transact->buf[0] = i2c_rndm_reg;	// The read half may have got as far as buf[0].
+			set_error(USI_I2C_ERR_NONE);
+			USICTL1 |= USIIFG | USIIE;				// i2c_state is I2C_S_START; straight back into the ISR.
+			watch_start();
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Start the posted transaction.  Interrupts must be disabled [or we're in the ISR].
+static inline void post_start(void)
+{
+	i2c_transact = i2c_post;
+	i2c_transact->status = I2C_TS_ACTIVE;
+	set_error(USI_I2C_ERR_NONE);
+	i2c_retries_used = 0;
+	usi_i2c_sys_info.flags |= USI_BUSY;
+	USICTL1 |= USIIE;
+	watch_start();
+}
+
+/*
+ * Called from the ISR once a transaction has put its stop condition on the bus.
+ * A transaction started by main() hands control back to main() as before.
+ * The posted transaction gets its completion status, frees the slot and gives the USI back.
+ * A failed transaction is retried per the retry policy before the error is passed to the error callback.
+ * Returns non-zero if main() should be woken.
+ */
+static inline int transaction_end(void)
+{
+	uint8_t err;
+
+	i2c_bus_cleared = 0;
+	err = usi_i2c_sys_info.error & USI_I2C_ERR_MASK;
+	if (err != USI_I2C_ERR_NONE)
+	{
+		if (retry_transaction())
+			return 0;
+		if (i2c_error_fn != NULL)
+			i2c_error_fn((i2c_transaction_t *)i2c_transact, (enum_usi_i2c_errors_t)err);
+	}
+
+	if ( (i2c_post == NULL) || (i2c_transact != i2c_post) )
+	{
+		usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;	// Signal that that there's an I2C event ready to handle.
+		USICTL1 &= ~USIIE;								// Turn off the USI interrupt.
+		return 1;
+	}
+
+	i2c_transact->status = (err == USI_I2C_ERR_NONE) ? I2C_TS_DONE : (I2C_TS_ERROR | err);
+	i2c_post = NULL;
+	usi_i2c_sys_info.flags &= ~USI_BUSY;				// The posted transaction owned the USI; give it back.
+	USICTL1 &= ~USIIE;
+	usi_i2c_sys_info.flags |= USI_I2C_POST_SIG;
+	return 1;
+}
+/*
+ * Free a bus that a slave is holding.  A slave that lost its place [reset or glitch mid-transaction] can be left
+ * driving SDA low; clock SCL until it lets go [at most 9 clocks], then put a stop on the bus.
+ * The USI is held in reset and SCL/SDA are driven as open drain GPIO while this runs; ~100us of busy waiting, so
+ * only from main().  The ISRs have the USI clock the same thing [I2C_S_BUS_CLR].
+ * Leaves USIIFG set, the same as after a stop, so the next start goes straight into the ISR.
+ */
+static void bus_recover(void)
+{
+	uint8_t i;
+
+	USICTL0 |= USISWRST;
+	USICTL0 &= ~(USIPE7 | USIPE6 | USIOE);			// SCL, SDA back to GPIO.
+	P1OUT &= ~(SCL_PIN | SDA_PIN);
+	P1DIR &= ~(SCL_PIN | SDA_PIN);					// Both released [pulled up].
+	for (i = 0; (i < 9) && !(P1IN & SDA_PIN); i++)
+	{
+		P1DIR |= SCL_PIN;							// SCL low.
+		__delay_cycles(USI_I2C_BUS_CLR_HALF_CLK);
+		P1DIR &= ~SCL_PIN;							// SCL high.
+		__delay_cycles(USI_I2C_BUS_CLR_HALF_CLK);
+	}
+	P1DIR |= SCL_PIN;								// Stop: SDA low -> high while SCL is high.
+	P1DIR |= SDA_PIN;
+	__delay_cycles(USI_I2C_BUS_CLR_HALF_CLK);
+	P1DIR &= ~SCL_PIN;
+	__delay_cycles(USI_I2C_BUS_CLR_HALF_CLK);
+	P1DIR &= ~SDA_PIN;
+	__delay_cycles(USI_I2C_BUS_CLR_HALF_CLK);
+
+	USICTL0 |= USIPE7 | USIPE6;						// Back to the USI.
+	USICTL0 &= ~USISWRST;
+	USICTL1 |= USIIFG;
+}
+
+// Drop whatever the USI was shifting and let go of SDA.  Leaves USIIFG set, the same as after a stop.
+static inline void usi_reset(void)
+{
+	USICTL0 |= USISWRST;
+	USICTL0 &= ~USIOE;
+	USICTL0 &= ~USISWRST;
+	USICTL1 |= USIIFG;
+}
+
+/*
+ * SDA should be high before a [repeated] start.  Called at I2C_S_START.
+ * Returns 1 if it isn't and the ISR is to clear the bus first; I2C_S_START runs again after the clear.
+ */
+static inline int bus_check(void)
+{
+	if (P1IN & SDA_PIN)
+		return 0;
+	if (i2c_bus_cleared)
+	{
+		set_error(USI_I2C_ERR_BUS_STUCK);
+		return 0;
+	}
+	i2c_bus_cleared = 1;
+	i2c_state = I2C_S_BUS_CLR;
+	return 1;
+}
 // End inline primitives.
 
 // Common provided functions
@@ -116,11 +403,14 @@ void usi_i2c_master_init(uint8_t usiClkSrc, uint8_t usiClkDiv)
 	USICTL1 = USII2C;								// USI in i2c mode.
 	//USICKCTL = USIDIV_5 | USISSEL_2 | USICKPL;		// Clock = SMCLK/32 [assumes 16MHz SMCLK].  Gives 500kHz SCL.
 	USICKCTL = usiClkDiv | usiClkSrc | USICKPL;
+	i2c_clk_div = usiClkDiv & I2C_CLK_DIV_MASK;		// Default rate; transactions can ask for another [clkDiv].
 	//USICNT |= USIIFGCC;								// Disable automatic clear control
 	USICTL0 &= ~USISWRST;							// USI out of reset.
 	//USICTL1 &= ~USIIFG;								// Clear pending interrupts.
 	//usi_i2c_error_state = 0;
 	usi_i2c_sys_info.error = USI_I2C_ERR_NONE;
+	if ( (P1IN & SDA_PIN) == 0 )					// A slave left hanging by a reset mid-transaction.
+		bus_recover();
 }
 
 int usi_i2c_busy(void)
@@ -136,7 +426,17 @@ int usi_i2c_get(void)
 
 void usi_i2c_release(void)
 {
+	uint16_t intState;
+
 	usi_i2c_sys_info.flags &= ~USI_BUSY;
+	if (i2c_post != NULL)							// A transaction posted behind main()'s can go now.
+	{
+		intState = __get_interrupt_state();
+		__disable_interrupt();
+		if ( (i2c_post != NULL) && (i2c_post->status == I2C_TS_POSTED) && !(usi_i2c_sys_info.flags & USI_BUSY) )
+			post_start();
+		__set_interrupt_state(intState);
+	}
 }
 
 void usi_i2c_raise_event(void)
@@ -159,6 +459,60 @@ enum_usi_i2c_errors_t usi_i2c_get_error(void)
 	return (usi_i2c_sys_info.error & USI_I2C_ERR_MASK);
 }
 
+// Called [from interrupt context] with the failed transaction once its retries are used up.  NULL for none.
+void usi_i2c_set_error_callback(i2c_error_fnptr_t errorFn)
+{
+	i2c_error_fn = errorFn;
+}
+
+// The policy table must stay valid while the driver is in use.  NULL for no retries.
+void usi_i2c_set_retry_policy(const i2c_retry_policy_t *policy)
+{
+	i2c_retry_policy = policy;
+}
+
+// Clear a stuck bus.  Only while the USI isn't in use.
+void usi_i2c_bus_clear(void)
+{
+	bus_recover();
+}
+
+#if USI_I2C_WDT == 1
+/*
+ * Timer_A0 CCR2 handler; call from the TIMER0_A1 ISR.
+ * Times out the transaction on the bus if the ISR hasn't moved it along since the last tick.
+ * Returns non-zero if main() should be woken.
+ */
+int usi_i2c_wdt_tick(void)
+{
+	if ( (USICTL1 & USIIE) == 0 )					// Nothing on the bus [done, or paused for main()].
+	{
+		USI_I2C_WDT_CCTL = 0;
+		return 0;
+	}
+	USI_I2C_WDT_CCR += USI_I2C_WDT_TICKS;
+	if (i2c_wdt_progress != i2c_wdt_seen)
+	{
+		i2c_wdt_seen = i2c_wdt_progress;
+		return 0;
+	}
+
+	// Stuck; most likely a slave stretching SCL forever.  The USI ISR clocks the bus clear and ends the transaction.
+	usi_reset();
+	if ( (i2c_state < I2C_S_BUS_CLR) || (i2c_state > I2C_S_BUS_CLR_END) )
+	{
+		set_error(USI_I2C_ERR_TIMEOUT);
+		i2c_state = I2C_S_BUS_CLR;
+		return 0;
+	}
+
+	// The clear is stuck as well; give up on the bus.
+	USICTL1 &= ~USIIE;
+	i2c_state = I2C_S_START;
+	return transaction_end();
+}
+#endif
+
 // For interaction with the interrupt driver.
 void usi_i2c_sleep_wait(uint8_t clear_flag)
 {
@@ -171,372 +525,274 @@ void usi_i2c_sleep_wait(uint8_t clear_flag)
 		usi_i2c_clear_event();					// Clear the I2C event flag.
 }
 
+// Carry on after a PAUSE with whatever buf, numBytes and transactType main() has set up.
 void usi_i2c_txrx_resume(void)
 {
+	i2c_buf = i2c_transact->buf;
+	i2c_count = i2c_transact->numBytes;
+	load_plan();
 	USICTL1 |= USIIE;
+	watch_start();
 }
 
+// Finish a paused transaction with a stop.
 void usi_i2c_txrx_stop(i2c_transaction_t *psI2cTransact)
 {
-	//psI2cTransact->state = I2C_S_PREP_STOP;
 	psI2cTransact->numBytes = 0;
+	i2c_stop_next = I2C_S_STOP;
+	i2c_state = I2C_S_PREP_STOP;
 	USICTL1 |= USIIE;
+	watch_start();
 }
 
 int usi_i2c_txrx_start(i2c_transaction_t *psI2cTransact)
 {
 	if (psI2cTransact != NULL)
 	{
+		if ( (psI2cTransact->flags & I2C_TF_SG) && ((psI2cTransact->numBytes = sg_length(psI2cTransact->segs)) == 0) )
+			return 1;
 		i2c_transact = psI2cTransact;
 		//i2c_transact->state = I2C_S_START;
+		set_error(USI_I2C_ERR_NONE);
+		i2c_retries_used = 0;
 		USICTL1 |= USIIE;
+		watch_start();
 		return 0;
 	}
 	return 1;
 }
 
 /* ***************************************
- * Implements a i2c random read.
- * Implies: TX addr and starting reg, restart, then get registers.
- * The caller must be a proper i2c_transaction_t function and must:
- * 		- take the USI.
- * 		- set numBytes in the i2c transaction structure = all bytes tx'd + rx'd [except address].
+ * Post a self contained [I2C_T_TX_STOP, I2C_T_RX_STOP or I2C_T_RX_RNDM] transaction to the single pending slot.
+ * If the USI is free the transaction starts straight away, otherwise it runs from usi_i2c_release() as soon as
+ * main()'s job gives the bus back, without main() having to come round for it.
+ * The descriptor and its buffer must stay valid until its status shows I2C_TS_DONE or I2C_TS_ERROR.
+ * callbackFn is not used for posted transactions.
+ * Returns 0 on success, 1 if the slot is taken or the transaction can't be posted.
  * ***************************************/
-/*void* usi_i2c_random_read(i2c_transaction_t *pI2cTrans, void *userdata)
+int usi_i2c_post(i2c_transaction_t *psI2cTransact)
 {
-	static uint8_t state = 0;
-	static uint8_t bytesToRx = 0;
-	static i2c_callback_fnptr_t myCallback = NULL;
-
-	switch (state)
+	uint16_t intState;
+	int ret = 1;
+
+	if ( (psI2cTransact == NULL) ||
+		 ((psI2cTransact->transactType != I2C_T_TX_STOP) && (psI2cTransact->transactType != I2C_T_RX_STOP) &&
+		  (psI2cTransact->transactType != I2C_T_RX_RNDM)) )
+		return 1;
+	if ( (psI2cTransact->flags & I2C_TF_SG) && ((psI2cTransact->numBytes = sg_length(psI2cTransact->segs)) == 0) )
+		return 1;
+
+	intState = __get_interrupt_state();
+	__disable_interrupt();
+	if (i2c_post == NULL)
 	{
-	case 0:		// Send Address and register to address.
-		myCallback = (userdata == NULL) ? NULL : (i2c_callback_fnptr_t)userdata;
-		//myCallback = pI2cTrans->callbackFn;
-		pI2cTrans->transactType = I2C_T_TX_RESTART;
-		bytesToRx = pI2cTrans->numBytes - 1;
-		pI2cTrans->numBytes = 1;
-		pI2cTrans->callbackFn = usi_i2c_random_read;
-		usi_i2c_txrx_start(pI2cTrans);
-
-		state = 1;
-		break;
-
-	case 1:		// Now get the data.
-		pI2cTrans->numBytes = bytesToRx;
-		pI2cTrans->address |= I2C_READ_BIT;
-		pI2cTrans->transactType = I2C_T_RX_STOP;
-		// Should somehow reset the buffer pointer.
-		usi_i2c_txrx_resume();
-
-		state = 2;
-		break;
+		psI2cTransact->status = I2C_TS_POSTED;
+		i2c_post = psI2cTransact;
+		if ( !(usi_i2c_sys_info.flags & USI_BUSY) )
+			post_start();
+		ret = 0;
+	}
+	__set_interrupt_state(intState);
 
-	case 2:		// Send control back to caller.
-		if (myCallback != NULL)
-		{
-			pI2cTrans->callbackFn = (i2c_callback_fnptr_t)myCallback;
-			usi_i2c_raise_event();
-		}
-		else
-		{
-			// Clean up?  There should always be a valid 'myCallback' to this function.
-		}
+	return ret;
+}
 
-		myCallback = NULL;
-		state = 0;
-		break;
+// Non-zero while the slot holds a transaction, waiting or on the bus.
+int usi_i2c_post_pending(void)
+{
+	return (i2c_post != NULL);
+}
 
-	default:
-		break;
-	}
+int usi_i2c_check_post_event(void)
+{
+	return ( (usi_i2c_sys_info.flags & USI_I2C_POST_SIG) != 0 );
+}
 
-	return NULL;
-}*/
+void usi_i2c_clear_post_event(void)
+{
+	usi_i2c_sys_info.flags &= ~USI_I2C_POST_SIG;
+}
 
+// Non-zero while a posted transaction is still waiting or on the bus.
+int usi_i2c_transact_pending(i2c_transaction_t *psI2cTransact)
+{
+	return ( (psI2cTransact->status & (I2C_TS_POSTED | I2C_TS_ACTIVE)) != 0 );
+}
 
 /******************************************************
 // USI interrupt service routine
-// Data Transmit : state
-// Data Receive  : state
+//
+// Table driven.  Everything that depends on the transaction type or direction is worked out once per
+// transaction [plan_transaction()] from i2c_plan_tbl, so the per-byte states only test the ACK bit and
+// the byte count and then load the next state.
+//
+// The ISR is entered once per USICNT expiry.  A state that doesn't load USICNT leaves USIIFG set, so the
+// ISR re-enters straight away into the next state; PREP_STOP and PAUSE rely on this.
+//
+// Worst case cycles per state at 16MHz [hand counted estimates; ~30 cycles of entry, dispatch and RETI included]:
+//	I2C_S_START			~130	once per transaction [plan + scatter-gather setup + SDA check + clock select]
+//	I2C_S_PREP_ACK_ADDR	 ~40
+//	I2C_S_ACK_ADDR		 ~50
+//	I2C_S_TX_BYTE		 ~60
+//	I2C_S_TX_BYTE_SG	~125	includes an lcd_xform_xxx() call
+//	I2C_S_PREP_ACK_TX	 ~40
+//	I2C_S_ACK_TX		 ~50
+//	I2C_S_RX_BYTE		 ~45
+//	I2C_S_ACK_RX		 ~60
+//	I2C_S_PAUSE			 ~45
+//	I2C_S_PREP_STOP		 ~45
+//	I2C_S_STOP			 ~50
+//	I2C_S_RNDM_RX		 ~70	once per random read
+//	I2C_S_BUS_CLR_xxx	 ~45	each; only to clear a stuck bus
+// A transmitted byte costs ~150 cycles [~215 scatter-gather] against 288 SMCLK cycles of bus time at 500kHz SCL.
 ******************************************************/
-#ifndef INTRPT_STYLE_2
 #pragma vector=USI_VECTOR
 __interrupt void USI_TXRX(void)
 {
-	static enum_i2c_state_t state = I2C_S_START;		// <-- May need to promote this to a static global because stuff may need to manipulate it.
 	int wake = 0;
 
-	switch(__even_in_range((state), I2C_S_STOP))
+	switch(__even_in_range(i2c_state, I2C_S_BUS_CLR_END))
 	{
 	case I2C_S_START:
-		start();
-		tx_byte(i2c_transact->address);
-		i2c_transact->address &= ~I2C_READ_BIT;			// Clear the read bit.  It's so we can get the ack for address transmit.  We'll set it back after based on the transaction type.
-		state = I2C_S_PREP_ACK_NACK;
-		break;
-
-	case I2C_S_TX_BYTE:
-		tx_byte(*i2c_transact->buf);
-		if (i2c_transact->numBytes)						// Make sure that numBytes > 0.
+		WDT_KICK();
+		plan_transaction();
+		set_clock(i2c_transact->clkDiv);
+		if (bus_check())
+			break;										// USIIFG is still set; straight on to the clear.
+		if (usi_i2c_sys_info.error & USI_I2C_ERR_MASK)
 		{
-			i2c_transact->numBytes--;
-			i2c_transact->buf++;						// Advance buffer index.
+			i2c_state = I2C_S_STOP;						// USIIFG is still set; straight on to finish up.
+			break;
 		}
-		state = I2C_S_PREP_ACK_NACK;
-		break;
-
-	case I2C_S_RX_BYTE:
-		rx_byte();
-		i2c_transact->numBytes--;
-		state = I2C_S_ACK_NACK;
+		start();
+		tx_byte(i2c_transact->address);
+		i2c_state = I2C_S_PREP_ACK_ADDR;
 		break;
 
-	case I2C_S_PREP_ACK_NACK:
+	case I2C_S_PREP_ACK_ADDR:
 		prep_ack_nack();
-		state = I2C_S_ACK_NACK;
+		i2c_state = I2C_S_ACK_ADDR;
 		break;
 
-	case I2C_S_ACK_NACK:
-	{
-		//Might have to check the I/O direction instead of address to figure out if the last transaction was a tx or rx.
-		//This is because even in a rx transaction the address must be transmitted first and then we need to get n/ack.
-		if (i2c_transact->address & 0x01)				// RX -> get data and send N/ACK
-		{
-			int ackNack = 0;
-			*i2c_transact->buf = get_rx_byte();
-			if (i2c_transact->numBytes > 0)
-			{
-				state = I2C_S_RX_BYTE;
-				i2c_transact->buf++;
-			}
-			else
-			{
-				if (i2c_transact->transactType == I2C_T_RX_WAIT)
-				{
-					state = I2C_S_RX_BYTE;				// Assume that whatever's holding the i2c will need to get more.
-					usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;
-					USICTL1 &= ~USIIE;					// Turn off the interrupt; main thread will need to turn it back on to resume.
-					wake = 1;							// The problem here is that we might wake up before finishing the ack.  Especially true for faster processors.
-				}										// Might be ok since the resume turns the interrupt back on and that will only go once the USI is ready.
-				else
-				{
-					ackNack = 0xff;
-					state = I2C_S_PREP_STOP;
-				}
-			}
-			send_ack_nack(ackNack);
-		}
-		else											//TX -> get N/ACK
-		{
-			int rxFlag = ((i2c_transact->transactType & 0x01) == 0);	// All of the RX transaction types have even enumerations. [idle case ignored]
-			if (rxFlag)													// This piece should only come into play after the address transmit
-				i2c_transact->address |= I2C_READ_BIT;					// because the address transmit clears the i2c read bit so we re-set it here.
-
-			/*int rxFlag = 0;
-			if ( (i2c_transact->transactType > I2C_T_IDLE) && ((i2c_transact->transactType & 0x01) == 0) )// All of the RX transaction types have even enumerations. [Probably don't have to do idle check].
-			{																						// This piece should only come into play after the address transmit
-				i2c_transact->address |= I2C_READ_BIT;												// because the address transmit clears the i2c read bit so we re-set it here.
-				rxFlag = 1;
-			}*/
-
-			if (get_ack_nack())
-			{
-				set_error(USI_I2C_ERR_NO_ACK_ON_DATA);
-				state = I2C_S_PREP_STOP;
-			}
-			else if (0 < i2c_transact->numBytes)
-			{
-				state = ((rxFlag == 0) ? I2C_S_TX_BYTE : I2C_S_RX_BYTE);
-				//state = ( ((i2c_transact->addr & I2C_READ_BIT) == 0) ? I2C_S_TX_BYTE : I2C_S_RX_BYTE );
-			}
-			else if (i2c_transact->transactType == I2C_T_TX_WAIT)
-			{
-				state = I2C_S_TX_BYTE;									// Assume that whatever's holding the i2c will need to send more.
-				usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;
-				USICTL1 &= ~USIIE;										// Turn off the interrupt; main thread will need to turn it back on to resume.
-				wake = 1;
-			}
-			else
-				state = I2C_S_PREP_STOP;
-		}
-		break;
-	}
-
-	case I2C_S_PREP_STOP:
-	{
-		int uStop = 0;
-		if (i2c_transact->transactType < I2C_T_TX_RESTART)
+	case I2C_S_ACK_ADDR:
+		if (get_ack_nack())
 		{
-			uStop = 1;
-			state = I2C_S_STOP;
+			set_error(USI_I2C_ERR_NO_ACK_ON_ADDRESS);
+			i2c_stop_next = I2C_S_STOP;					// Always finish with a stop on error.
+			i2c_state = I2C_S_PREP_STOP;
 		}
 		else
-		{
-			// It's a repeated start type transaction.
-			//uStop = 0;
-			state = I2C_S_START;
-			usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;
-			USICTL1 &= ~USIIE;							// Turn off the interrupt; main thread will need to turn it back on to resume.
-			wake = 1;
-		}
-		prep_stop(uStop);
+			i2c_state = (i2c_count) ? i2c_data_state : i2c_after_last;
 		break;
-	}
 
-	case I2C_S_STOP:
-		// Because of the previous shift of the data register [PREP_STOP] the MSB now =1.
-		stop();
-		usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;	// Signal that that there's an I2C event ready to handle.
-		state = I2C_S_START;
-		// The reason that we don't set the states to idle here is because we're not sure where we'll end up when we step back to main().
-		// We may end up somewhere where the next pending event will try to grab the USI and see that it's free and then clobber the data
-		// we just got from, for instance, a read transaction.  Probably not a big deal for writes.
-		//i2c_transact->transactType = I2C_T_IDLE;
-		USICTL1 &= ~USIIE;								// Turn off the USI interrupt.
-		wake = 1;										// Wake from interrupt.
+	case I2C_S_TX_BYTE:
+		WDT_KICK();
+		tx_byte(*i2c_buf++);
+		i2c_count--;
+		i2c_state = I2C_S_PREP_ACK_TX;
 		break;
 
-	/*default:
-		//_never_executed();
-		// Should never get here; recover?
-		break;*/
-	}
-
-	if (wake)
-		__bic_SR_register_on_exit(gSysSleepMode);		// Wake up.
-}
-#else
-// Attempt to simplify the interrupt logic by adding extra states for the address transmit.
-#pragma vector=USI_VECTOR
-__interrupt void USI_TXRX(void)
-{
-	static enum_i2c_state_t state = I2C_S_START;		// <-- May need to promote this to a static global because stuff may need to manipulate it.
-	int wake = 0;
+	case I2C_S_TX_BYTE_SG:
+		WDT_KICK();
+		tx_byte(sg_next_byte());
+		i2c_count--;
+		i2c_state = I2C_S_PREP_ACK_TX;
+		break;
 
-	switch(__even_in_range((state), I2C_S_STOP))
-	{
-	case I2C_S_START:
-		start();
-		tx_byte(i2c_transact->address);
-		state = I2C_S_PREP_ACK_NACK_ADDR;
+	case I2C_S_PREP_ACK_TX:
+		prep_ack_nack();
+		i2c_state = I2C_S_ACK_TX;
 		break;
 
-	case I2C_S_TX_BYTE:
-		tx_byte(*i2c_transact->buf);
-		if (i2c_transact->numBytes)						// Make sure that numBytes > 0.
+	case I2C_S_ACK_TX:
+		if (get_ack_nack())
 		{
-			i2c_transact->numBytes--;
-			i2c_transact->buf++;						// Advance buffer index.
+			set_error(USI_I2C_ERR_NO_ACK_ON_DATA);
+			i2c_stop_next = I2C_S_STOP;
+			i2c_state = I2C_S_PREP_STOP;
 		}
-		state = I2C_S_PREP_ACK_NACK;
+		else
+			i2c_state = (i2c_count) ? i2c_data_state : i2c_after_last;
 		break;
 
 	case I2C_S_RX_BYTE:
+		WDT_KICK();
 		rx_byte();
-		i2c_transact->numBytes--;
-		state = I2C_S_ACK_NACK;
+		i2c_count--;
+		i2c_state = I2C_S_ACK_RX;
 		break;
 
-	case I2C_S_PREP_ACK_NACK_ADDR:
-		// Fall through...
-	case I2C_S_PREP_ACK_NACK:
-		prep_ack_nack();
-		state = (state == I2C_S_PREP_ACK_NACK_ADDR) ? I2C_S_ACK_NACK_ADDR : I2C_S_ACK_NACK;
-		break;
-
-	case I2C_S_ACK_NACK_ADDR:
-		// Fall through...
-	case I2C_S_ACK_NACK:
-		if ( ((i2c_transact->address & I2C_READ_BIT) == 0) || (state == I2C_S_ACK_NACK_ADDR) )	//TX -> get N/ACK
+	case I2C_S_ACK_RX:
+		*i2c_buf++ = get_rx_byte();
+		if (i2c_count)
 		{
-			if (get_ack_nack())
-			{
-				(state == I2C_S_ACK_NACK_ADDR) ? set_error(USI_I2C_ERR_NO_ACK_ON_ADDRESS) : set_error(USI_I2C_ERR_NO_ACK_ON_DATA);
-				state = I2C_S_PREP_STOP;
-			}
-			else if (i2c_transact->numBytes > 0)
-			{
-				state = (i2c_transact->address & I2C_READ_BIT) ? I2C_S_RX_BYTE : I2C_S_TX_BYTE;
-			}
-			else if (i2c_transact->transactType == I2C_T_TX_WAIT)
-			{
-				state = I2C_S_TX_BYTE;									// Assume that whatever's holding the i2c will need to send more.
-				usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;
-				USICTL1 &= ~USIIE;										// Turn off the interrupt; main thread will need to turn it back on to resume.
-				wake = 1;
-			}
-			else
-				state = I2C_S_PREP_STOP;
+			send_ack_nack(0);
+			i2c_state = I2C_S_RX_BYTE;
 		}
-		else											// RX -> get data and send N/ACK
+		else
 		{
-			int ack_nack = 0;
-			*i2c_transact->buf = get_rx_byte();
-			if (i2c_transact->numBytes > 0)
-			{
-				state = I2C_S_RX_BYTE;
-				i2c_transact->buf++;
-			}
-			else
-			{
-				if (i2c_transact->transactType == I2C_T_RX_WAIT)
-				{
-					state = I2C_S_RX_BYTE;				// Assume that whatever's holding the i2c will need to get more.
-					usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;
-					USICTL1 &= ~USIIE;					// Turn off the interrupt; main thread will need to turn it back on to resume.
-					wake = 1;							// The problem here is that we might wake up before finishing the ack.  Especially true for faster processors.
-				}										// Might be ok since the resume turns the interrupt back on and that will only go once the USI is ready.
-				else
-				{
-					ack_nack = 0xff;
-					state = I2C_S_PREP_STOP;
-				}
-			}
-			send_ack_nack(ack_nack);
+			send_ack_nack(i2c_last_nack);				// NACK the last byte unless main() is going to ask for more.
+			i2c_state = i2c_after_last;
 		}
 		break;
 
+	case I2C_S_PAUSE:
+		// Hand control to main() without a stop [WAIT types, or the restart of a RESTART type].
+		// main() resumes with usi_i2c_txrx_resume(), which re-enables the interrupt.
+		usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;
+		USICTL1 &= ~USIIE;
+		i2c_state = i2c_resume_state;
+		wake = 1;
+		break;
+
 	case I2C_S_PREP_STOP:
-	{
-		int stop = 0;
-		if (i2c_transact->transactType < I2C_T_TX_RESTART)
-		{
-			stop = 1;
-			state = I2C_S_STOP;
-		}
-		else
-		{
-			// It's a repeated start type transaction.
-			state = I2C_S_START;
-			usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;
-			USICTL1 &= ~USIIE;							// Turn off the interrupt; main thread will need to turn it back on to resume.
-			wake = 1;
-		}
-		prep_stop(stop);
+		prep_stop(i2c_stop_next == I2C_S_STOP);		// Stop, or a '1' ready for a repeated start.
+		i2c_state = i2c_stop_next;
 		break;
-	}
 
 	case I2C_S_STOP:
 		// Because of the previous shift of the data register [PREP_STOP] the MSB now =1.
 		stop();
-		usi_i2c_sys_info.flags |= USI_I2C_EVENT_SIG;	// Signal that that there's an I2C event ready to handle.
-		state = I2C_S_START;
-		// The reason that we don't set the states to idle here is because we're not sure where we'll end up when we step back to main().
+		i2c_state = I2C_S_START;
+		// The reason that we don't set the transaction to idle here is because we're not sure where we'll end up when we step back to main().
 		// We may end up somewhere where the next pending event will try to grab the USI and see that it's free and then clobber the data
 		// we just got from, for instance, a read transaction.  Probably not a big deal for writes.
-		//i2c_transact->transactType = I2C_T_IDLE;
-		USICTL1 &= ~USIIE;								// Turn off the USI interrupt.
-		wake = 1;										// Wake from interrupt.
+		wake = transaction_end();						// Hand back to main() or free the posted slot.
+		break;
+
+	case I2C_S_RNDM_RX:
+		// The register pointer is written and the bus is ready for a repeated start; read back into buf.
+		i2c_buf = i2c_transact->buf;
+		i2c_count = i2c_transact->numBytes;
+		i2c_data_state = I2C_S_RX_BYTE;
+		i2c_stop_next = I2C_S_STOP;
+		start();
+		tx_byte(i2c_transact->address | I2C_READ_BIT);
+		i2c_state = I2C_S_PREP_ACK_ADDR;
 		break;
 
-	/*default:
-		//_never_executed();
-		// Should never get here; recover?
-		break;*/
+	case I2C_S_BUS_CLR:
+		// SDA released and 9 clocks: a slave part way through a byte finishes it and takes the 9th as a NACK.
+		WDT_KICK();
+		USICTL0 &= ~USIOE;
+		load_count(9);
+		i2c_state = I2C_S_BUS_CLR_STOP;
+		break;
+
+	case I2C_S_BUS_CLR_STOP:
+		WDT_KICK();
+		prep_stop(1);
+		i2c_state = I2C_S_BUS_CLR_END;
+		break;
+
+	case I2C_S_BUS_CLR_END:
+		stop();
+		i2c_state = I2C_S_START;
+		if (usi_i2c_sys_info.error & USI_I2C_ERR_MASK)
+			wake = transaction_end();					// Timed out; the transaction is over.
+		break;										// Otherwise back to I2C_S_START to check SDA again.
 	}
 
 	if (wake)
 		__bic_SR_register_on_exit(gSysSleepMode);		// Wake up.
 }
-#endif
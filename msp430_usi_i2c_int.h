@@ -13,7 +13,6 @@
 #include <stddef.h>
 
 
-#define INTRPT_STYLE_2
 //For MSP430G2452
 #define I2C_PORT_SEL		P1SEL
 #define I2C_PORT_SEL2		P1SEL2
@@ -42,9 +41,34 @@
 #define USI_I2C_NO_DATA				0x08	// Transmission buffer is empty
 #define USI_I2C_DATA_OUT_OF_BOUND	0x09	// Transmission buffer is outside SRAM space
 #define USI_I2C_BAD_MEM_READ		0x0A	// Error during external memory read
+#define USI_I2C_TIMEOUT				0x0B	// The transaction stopped making progress [see USI_I2C_WDT]
+#define USI_I2C_BUS_STUCK			0x0C	// SDA still held low after a bus clear
 
 #define USI_I2C_EVENT_SIG			0x80
 #define USI_BUSY					0x40
+#define USI_I2C_POST_SIG			0x20	// The posted transaction has completed [see usi_i2c_post()].
+
+// Bus watchdog and recovery.
+// The watchdog runs on Timer_A0 CCR2 while the USI interrupt is enabled; Timer_A0 must be running from SMCLK in continuous mode.
+// The application's TIMER0_A1 ISR must call usi_i2c_wdt_tick() on a CCR2 match.
+// A transaction that makes no progress for a whole watchdog period is abandoned, the ISR clears the bus and the
+// transaction ends with USI_I2C_ERR_TIMEOUT.  A clear that makes no progress either is abandoned the same way, so
+// nothing waiting on a transaction blocks for much more than 4 periods.
+// Neither ISR spins for the clear: the USI clocks it [I2C_S_BUS_CLR].  Only usi_i2c_master_init() and
+// usi_i2c_bus_clear(), from main(), clock it by hand.
+#define USI_I2C_WDT					1
+#define USI_I2C_WDT_TICKS			32000u	// Watchdog period in Timer_A0 ticks; 2ms at 16MHz.  At least one byte time.
+#define USI_I2C_WDT_CCR				TA0CCR2
+#define USI_I2C_WDT_CCTL			TA0CCTL2
+#define USI_I2C_BUS_CLR_HALF_CLK	80		// Half period of the hand clocked bus clear in MCLK cycles; 5us [100kHz] at 16MHz.
+
+// Transaction flags.
+#define I2C_TF_SG					0x01	// Transmit from the segment list in 'segs' instead of 'buf'.
+
+// Per transaction SCL rate [i2c_transaction_t.clkDiv]: a USIDIV_x value, or 0 for the rate given to usi_i2c_master_init().
+// SCL = USI clock / 2^USIDIV; with a 16MHz SMCLK USIDIV_4 is 1MHz, USIDIV_5 500kHz, USIDIV_6 250kHz and USIDIV_7 125kHz.
+#define I2C_CLK_DEFAULT				0
+#define I2C_CLK_DIV_MASK			0xe0	// USIDIV bits of USICKCTL.
 
 //Type definitions
 typedef enum
@@ -60,6 +84,8 @@ typedef enum
 	USI_I2C_ERR_NO_DATA				= 0x08,	// Transmission buffer is empty
 	USI_I2C_ERR_DATA_OUT_OF_BOUND	= 0x09,	// Transmission buffer is outside SRAM space
 	USI_I2C_ERR_BAD_MEM_READ		= 0x0a,	// Error during external memory read
+	USI_I2C_ERR_TIMEOUT				= 0x0b,	// The transaction stopped making progress [see USI_I2C_WDT]
+	USI_I2C_ERR_BUS_STUCK			= 0x0c,	// SDA still held low after a bus clear
 	USI_I2C_ERR_MASK				= 0x0f	// Mask to retrieve the errors from the union.
 } enum_usi_i2c_errors_t;
 
@@ -71,40 +97,67 @@ typedef enum
 	I2C_T_TX_WAIT			= 3,	// Transmit n bytes then hand control to main thread without issuing stop.
 	I2C_T_RX_WAIT			= 4,	// Receive n bytes then hand control to main thread without issuing stop.
 	I2C_T_TX_RESTART		= 5,
-	I2C_T_RX_RESTART		= 6
-	//I2C_T_RX_RNDM			= 8		// Random read; implies tx_restart followed by rx_stop.
+	I2C_T_RX_RESTART		= 6,
+	I2C_T_RX_RNDM			= 7		// Random read: write buf[0] [register pointer], repeated start, read numBytes into buf, stop.
 } enum_i2c_transact_type_t;
 
-#ifndef INTRPT_STYLE_2
+// Completion status of a posted transaction.
+// On error the low nibble holds the enum_usi_i2c_errors_t code.
 typedef enum
 {
-	I2C_S_START				= 0,
-	I2C_S_TX_BYTE			= 2,
-	I2C_S_RX_BYTE			= 4,
-	I2C_S_PREP_ACK_NACK		= 6,
-	I2C_S_ACK_NACK			= 8,
-	I2C_S_PREP_STOP			= 10,
-	I2C_S_STOP				= 12
-} enum_i2c_state_t;
-#else
+	I2C_TS_IDLE				= 0x00,
+	I2C_TS_POSTED			= 0x10,
+	I2C_TS_ACTIVE			= 0x20,
+	I2C_TS_DONE				= 0x40,
+	I2C_TS_ERROR			= 0x80,
+	I2C_TS_STATE_MASK		= 0xf0
+} enum_i2c_transact_status_t;
+
+// USI ISR states.  Even values for __even_in_range().
 typedef enum
 {
 	I2C_S_START					= 0,
-	I2C_S_TX_BYTE				= 2,
-	I2C_S_RX_BYTE				= 4,
-	I2C_S_PREP_ACK_NACK_ADDR	= 6,
-	I2C_S_PREP_ACK_NACK			= 8,
-	I2C_S_ACK_NACK_ADDR			= 10,
-	I2C_S_ACK_NACK				= 12,
-	I2C_S_PREP_STOP				= 14,
-	I2C_S_STOP					= 16
+	I2C_S_PREP_ACK_ADDR			= 2,
+	I2C_S_ACK_ADDR				= 4,
+	I2C_S_TX_BYTE				= 6,
+	I2C_S_TX_BYTE_SG			= 8,
+	I2C_S_PREP_ACK_TX			= 10,
+	I2C_S_ACK_TX				= 12,
+	I2C_S_RX_BYTE				= 14,
+	I2C_S_ACK_RX				= 16,
+	I2C_S_PAUSE					= 18,
+	I2C_S_PREP_STOP				= 20,
+	I2C_S_STOP					= 22,
+	I2C_S_RNDM_RX				= 24,		// Repeated start into the read half of an I2C_T_RX_RNDM.
+	I2C_S_BUS_CLR				= 26,		// Clock a slave off SDA [bus_check(), usi_i2c_wdt_tick()]
+	I2C_S_BUS_CLR_STOP			= 28,		// then put a stop on the bus.
+	I2C_S_BUS_CLR_END			= 30
 } enum_i2c_state_t;
-#endif
 
 typedef struct _i2c_transaction_t i2c_transaction_t;
 
 typedef void* (*i2c_callback_fnptr_t)( i2c_transaction_t *, void * );
 
+// Per-segment transform; returns the bus byte for output 'phase' [0..reps-1] of source byte 'data'.
+// Called from the ISR so keep it short.
+typedef uint8_t (*i2c_xform_fnptr_t)( uint8_t data, uint8_t phase );
+
+/*
+ * One piece of a scatter-gather transmit.
+ * Each source byte is put on the bus 'reps' times [0 is treated as 1], passed through 'xform' if there is one.
+ * len = 0 means the source is a NUL terminated string [the NUL isn't sent].
+ * A segment list is terminated with I2C_SEG_END.
+ */
+typedef struct _i2c_segment_t
+{
+	const volatile uint8_t*				buf;
+	uint8_t								len;
+	uint8_t								reps;
+	i2c_xform_fnptr_t					xform;
+} i2c_segment_t;
+
+#define I2C_SEG_END		{ NULL, 0, 0, NULL }
+
 struct _i2c_transaction_t
 {
 	volatile uint8_t					address;
@@ -112,8 +165,26 @@ struct _i2c_transaction_t
 	volatile enum_i2c_transact_type_t	transactType;
 	i2c_callback_fnptr_t				callbackFn;
 	volatile uint8_t*					buf;
+	volatile uint8_t					status;				// enum_i2c_transact_status_t; only maintained for posted transactions.
+	uint8_t								flags;				// I2C_TF_xxx
+	const i2c_segment_t*				segs;				// Segment list when I2C_TF_SG is set; numBytes is then filled in by the driver.
+	uint8_t								clkDiv;				// SCL rate for this transaction; USIDIV_x or I2C_CLK_DEFAULT.
 };
 
+// Called from interrupt context when a transaction finally fails [after any retries]; keep it short.
+typedef void (*i2c_error_fnptr_t)( i2c_transaction_t *, enum_usi_i2c_errors_t );
+
+/*
+ * Retry policy; one entry per device, terminated with an address of 0.
+ * A failed I2C_T_TX_STOP, I2C_T_RX_STOP or I2C_T_RX_RNDM transaction is run again from its start up to 'retries' times
+ * before the error is reported.  Other transaction types are never retried since main() has already seen part of them.
+ */
+typedef struct _i2c_retry_policy_t
+{
+	uint8_t								address;			// Device address [read bit ignored].
+	uint8_t								retries;
+} i2c_retry_policy_t;
+
 typedef union _usi_i2c_sys_info_t
 {
 	enum_usi_i2c_errors_t	error;
@@ -134,11 +205,22 @@ void usi_i2c_raise_event(void);
 void usi_i2c_clear_event(void);
 int usi_i2c_check_event(void);
 enum_usi_i2c_errors_t usi_i2c_get_error(void);
+void usi_i2c_set_error_callback(i2c_error_fnptr_t errorFn);
+void usi_i2c_set_retry_policy(const i2c_retry_policy_t *policy);
+void usi_i2c_bus_clear(void);
+#if USI_I2C_WDT == 1
+int usi_i2c_wdt_tick(void);
+#endif
 
 void usi_i2c_sleep_wait(uint8_t clear_flag);
 void usi_i2c_txrx_resume(void);
 void usi_i2c_txrx_stop(i2c_transaction_t *psI2cTransact);
 int usi_i2c_txrx_start(i2c_transaction_t *psI2cTransact);
-//void* usi_i2c_random_read(i2c_transaction_t *pI2cTrans, void *userdata);
+
+int usi_i2c_post(i2c_transaction_t *psI2cTransact);
+int usi_i2c_post_pending(void);
+int usi_i2c_check_post_event(void);
+void usi_i2c_clear_post_event(void);
+int usi_i2c_transact_pending(i2c_transaction_t *psI2cTransact);
 
 #endif /* MSP430_USI_I2C_INT_H_ */
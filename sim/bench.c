@@ -0,0 +1,733 @@
+/*
+ * bench.c
+ *
+ * Runs the I2C driver, LCD and RTC libraries against the simulated bus and devices and reports what each
+ * operation costs: interrupts, SCL clocks, bus frames, time and wakeups.  Also checks that the devices
+ * ended up in the expected state, so it doubles as a regression run.  Exits non-zero if a check fails.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "sim.h"
+#include "msp430_usi_i2c_int.h"
+#include "lcd.h"
+#include "lcd_layout.h"
+#include "backlight.h"
+#include "ds3231m_lib.h"
+#include "i2c_arbiter.h"
+
+#define NO_DEV_ADDR		0xa0			// Nothing at this address.
+#define ARB_RTC			0				// Arbiter clients, highest priority first.
+#define ARB_LCD			1
+#define ARB_LCD_INIT	2
+#define BV_LABEL		0x01			// Layout values.
+#define BV_COUNT		0x02
+#define LAYOUT_ROW		(LCD_ROWS / 2)			// Row the test layout draws on.
+
+const uint16_t gSysSleepMode = LPM0_bits;
+#if LCD_ROWS == 4
+const uint8_t gLcdRowOffsets[LCD_ROWS] = { 0x00, 0x40, 0x14, 0x54 };
+#else
+const uint8_t gLcdRowOffsets[LCD_ROWS] = { 0x00, 0x40 };
+#endif
+
+static sim_ds3231_t			rtc;
+static sim_mcp23008_t		exp;
+static i2c_transaction_t	trn;
+static i2c_transaction_t	blTrn;
+static volatile uint8_t		buf[24];
+static volatile uint8_t		blBuf[2];
+static volatile uint8_t		ioReg = IO_EXP_IO_REG;
+static volatile uint8_t		line[LCD_COLS + 2];
+static sim_counters_t		mark;
+static int					failures;
+static uint8_t				errCount;
+static enum_usi_i2c_errors_t	lastErr;
+static uint8_t				arbReady;
+static uint8_t				arbYield;
+static uint8_t				arbParks;			// Times arb_lcd_job() gave way.
+static uint8_t				arbRtcStarted;
+static const char			*arbName;
+static uint16_t				layoutCount;
+static uint8_t				fmtCalls;
+
+static void* arb_rtc_job(i2c_transaction_t *t, void *userdata);
+static void* arb_lcd_job(i2c_transaction_t *t, void *userdata);
+
+const i2c_arb_client_t gI2cArbClients[I2C_ARB_NUM_CLIENTS] = {	{ arb_rtc_job },
+																{ arb_lcd_job },
+																{ lcd_init_async_int } };
+
+static const i2c_retry_policy_t retryPolicy[] = {	{ NO_DEV_ADDR, 2 },
+													{ 0, 0 } };
+static const i2c_retry_policy_t rtcRetryPolicy[] = {	{ RTC_ADDR, 1 },
+														{ 0, 0 } };
+
+static const i2c_segment_t lineSegs[] = {	{ &ioReg, 1, 1, NULL },
+											{ &line[0], 1, LCD_BUS_BYTES_PER_CHAR, lcd_xform_cmd },
+											{ &line[1], 1, LCD_BUS_RS_BYTES, lcd_xform_rs_char },
+											{ &line[1], 0, LCD_BUS_BYTES_PER_CHAR, lcd_xform_char },
+											{ &ioReg, 1, 1, lcd_xform_rs_cmd },
+											I2C_SEG_END };
+
+// I2C frames for a line of n characters through lineSegs: address, register, the command, RS up, the characters, RS down.
+#define LINE_FRAMES(n)	(2 + LCD_BUS_BYTES_PER_CHAR * (1 + (n)) + LCD_BUS_RS_BYTES + 1)
+
+static void i2c_error(i2c_transaction_t *psI2cTransact, enum_usi_i2c_errors_t err)
+{
+	(void)psI2cTransact;
+	errCount++;
+	lastErr = err;
+}
+
+static void check(int ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("  FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void begin(void)
+{
+	sim_get_counters(&mark);
+}
+
+static void report(const char *name)
+{
+	sim_counters_t now;
+
+	sim_get_counters(&now);
+	printf("%-22s %6u %6u %6u %6u %9.1f %9.1f %6u %6u\n", name,
+		   (unsigned)(now.isrs - mark.isrs), (unsigned)(now.sclClocks - mark.sclClocks),
+		   (unsigned)(now.frames - mark.frames), (unsigned)(now.starts - mark.starts),
+		   SIM_CYCLES_TO_US(now.cycles - mark.cycles), SIM_CYCLES_TO_US(now.sleepCycles - mark.sleepCycles),
+		   (unsigned)(now.wakeups - mark.wakeups), (unsigned)(now.timerIsrs - mark.timerIsrs));
+}
+
+static uint32_t frames_since_begin(void)
+{
+	sim_counters_t now;
+
+	sim_get_counters(&now);
+	return now.frames - mark.frames;
+}
+
+static uint32_t timer_isrs_since_begin(void)
+{
+	sim_counters_t now;
+
+	sim_get_counters(&now);
+	return now.timerIsrs - mark.timerIsrs;
+}
+
+static void run_wait(i2c_transaction_t *t)
+{
+	usi_i2c_txrx_start(t);
+	usi_i2c_sleep_wait(1);
+	t->transactType = I2C_T_IDLE;
+}
+
+static void rtc_read_time(void)
+{
+	trn.buf = buf;
+	ds3231m_get_time(&trn);
+	run_wait(&trn);
+}
+
+static void bench_rtc(void)
+{
+	static const uint8_t t0[] = { 0x56, 0x34, 0x12, 0x03, 0x28, 0x02, 0x24 };
+	DateTime_t dt = { 59, 59, 23, 7, 31, 12, 25, 0 };
+	uint8_t status;
+
+	begin();
+	status = ds3231m_init(&trn, buf);
+	report("rtc init");
+	check(status == 0x88, "rtc init returns the status register");
+	check( (rtc.reg[RTC_CONTROL] == 0) && (rtc.reg[RTC_STATUS] == 0), "rtc init clears control and status");
+
+	begin();
+	ds3231m_init(&trn, buf);
+	report("rtc init [warm]");
+	check(frames_since_begin() == 5, "rtc init with nothing to change is one 5 frame read");
+
+	trn.buf = buf;
+	memcpy(rtc.reg, t0, sizeof(t0));
+	begin();
+	rtc_read_time();
+	report("rtc get time");
+	check(memcmp((const uint8_t *)buf, t0, sizeof(t0)) == 0, "rtc get time reads the time registers");
+	check(frames_since_begin() == 10, "rtc get time is one 10 frame random read");
+
+	trn.buf = buf;
+	begin();
+	ds3231m_set_time(&dt, &trn);
+	run_wait(&trn);
+	report("rtc set time");
+	check( (rtc.reg[0] == 0x59) && (rtc.reg[2] == 0x23) && (rtc.reg[4] == 0x31) && (rtc.reg[6] == 0x25),
+		   "rtc set time writes BCD time");
+
+	sim_ds3231_tick(&rtc, 1);
+	rtc_read_time();
+	check( (buf[0] == 0x00) && (buf[4] == 0x01) && (buf[5] == 0x01) && (buf[6] == 0x26), "rtc rolls over the year");
+}
+
+// Local timekeeping [datetime_tick() on each 1Hz edge] against the RTC through month ends, a leap day and a year end.
+static void bench_timekeeping(void)
+{
+	static const uint8_t starts[][7] = {	{ 0x50, 0x59, 0x23, 0x03, 0x28, 0x02, 0x23 },	// Feb 28th, not a leap year
+											{ 0x50, 0x59, 0x23, 0x04, 0x28, 0x02, 0x24 },	// leap year
+											{ 0x50, 0x59, 0x23, 0x07, 0x30, 0x04, 0x24 },	// 30 day month
+											{ 0x50, 0x59, 0x23, 0x04, 0x31, 0x12, 0x99 } };	// year end
+	DateTime_t dt, ref;
+	uint32_t sec;
+	uint8_t i, same = 1;
+
+	for (i = 0; i < sizeof(starts) / sizeof(starts[0]); i++)
+	{
+		memcpy(rtc.reg, starts[i], sizeof(starts[i]));
+		rtc_read_time();
+		convert_array_to_datetime((uint8_t *)buf, &dt, 1);
+		for (sec = 0; sec < 2ul * 24 * 3600; sec++)
+		{
+			sim_ds3231_tick(&rtc, 1);
+			datetime_tick(&dt);
+			convert_array_to_datetime(rtc.reg, &ref, 1);
+			same &= (memcmp(&dt, &ref, sizeof(dt)) == 0);
+		}
+	}
+	check(same, "local time keeps step with the rtc over two days from each start");
+
+	dt.bcd_format = 0;
+	dt.seconds = 59; dt.minutes = 59; dt.hours = 23; dt.dow = 7; dt.dom = 28; dt.month = 2; dt.year = 24;
+	check( datetime_tick(&dt) && (dt.dom == 29) && (dt.dow == 1) && (dt.hours == 0), "local time in decimal carries too");
+}
+
+static void fmt_label(uint8_t *b, uint8_t width, const void *arg)
+{
+	fmtCalls++;
+	sprintf((char *)b, "%-*s", width, (const char *)arg);
+}
+
+static void fmt_count(uint8_t *b, uint8_t width, const void *arg)
+{
+	fmtCalls++;
+	sprintf((char *)b, "%-*u", width, *(const uint16_t *)arg);
+}
+
+static const lcd_layout_field_t layoutFields[] = {	{ LAYOUT_ROW, 0, 6, BV_LABEL, fmt_label, "Count:" },
+													{ LAYOUT_ROW, 6, 5, BV_COUNT, fmt_count, &layoutCount } };
+static const lcd_layout_t layout = LCD_LAYOUT(layoutFields);
+
+// Draws the stale fields the way drawLayoutSM() does, a line write each.
+static void layout_lines(void)
+{
+	while (lcd_layout_next_field(line))
+	{
+		trn.address = IO_EXPANDER_ADDR;
+		trn.clkDiv = LCD_I2C_CLK_DIV;
+		trn.segs = lineSegs;
+		trn.flags = I2C_TF_SG;
+		trn.transactType = I2C_T_TX_STOP;
+		run_wait(&trn);
+		trn.flags = 0;
+	}
+}
+
+static void layout_draw(const char *name)
+{
+	begin();
+	layout_lines();
+	report(name);
+}
+
+static void bench_layout(void)
+{
+	char row[LCD_COLS + 1];
+
+	layoutCount = 7;
+	fmtCalls = 0;
+	lcd_layout_select(&layout);
+	layout_draw("layout [all fields]");
+	check(frames_since_begin() == LINE_FRAMES(6) + LINE_FRAMES(5), "select draws every field");
+	sim_hd44780_row(&exp.lcd, LAYOUT_ROW, 11, row);
+	check(strcmp(row, "Count:7    ") == 0, "fields drawn where the layout puts them");
+
+	fmtCalls = 0;
+	layout_draw("layout [untouched]");
+	check( (frames_since_begin() == 0) && (fmtCalls == 0), "untouched fields aren't formatted or sent");
+
+	layoutCount = 12345;
+	lcd_layout_touch(BV_COUNT);
+	layout_draw("layout [one value]");
+	check( (frames_since_begin() == LINE_FRAMES(5)) && (fmtCalls == 1), "only the touched field is redrawn");
+	sim_hd44780_row(&exp.lcd, LAYOUT_ROW, 11, row);
+	check(strcmp(row, "Count:12345") == 0, "touched field shows the new value");
+}
+
+static void bench_lcd(void)
+{
+	static const uint8_t lineRates[] = { USIDIV_6, USIDIV_5, LCD_I2C_CLK_DIV };
+	char row[21];
+	char name[24];
+	unsigned i;
+	unsigned lineLen[2];
+	uint32_t lineFrames[2];
+	uint32_t perChar;
+
+	begin();
+	check(lcd_check_io_expander_no_init_int(&trn, buf), "expander found in its power on state");
+	report("lcd probe");
+
+	begin();
+	lcd_io_expander_init_int(&trn, buf);
+	report("expander init");
+	check( (exp.reg[0x00] == 0x00) && (exp.reg[0x05] == 0x20), "expander outputs on, sequential addressing off");
+
+	begin();
+	lcd_init_int(&trn, buf);
+	report("lcd init");
+	check(exp.lcd.fourBit && (exp.lcd.display == 0x04), "lcd in 4-bit mode with the display on");
+
+	// The same line at each SCL rate; the last one is the LCD's own rate.
+	for (i = 0; i < sizeof(lineRates); i++)
+	{
+		line[0] = 0x80 | 0x40;
+		strcpy((char *)&line[1], "Sim 12:34:56");
+		line[12] = '0' + i;
+		trn.address = IO_EXPANDER_ADDR;
+		trn.clkDiv = lineRates[i];
+		trn.flags = I2C_TF_SG;
+		trn.segs = lineSegs;
+		trn.transactType = I2C_T_TX_STOP;
+		begin();
+		run_wait(&trn);
+		sprintf(name, "lcd line [sg, div %u]", 1u << (lineRates[i] >> 5));
+		report(name);
+		trn.flags = 0;
+		sim_hd44780_row(&exp.lcd, 1, 12, row);
+		check(row[11] == line[12], "line shows on row 2");
+	}
+
+	// Bus cost of the encoding: bytes per character from two line lengths, and what a line costs on top.
+	for (i = 0; i < 2; i++)
+	{
+		lineLen[i] = (i) ? LCD_COLS : 4;
+		line[0] = 0x80;
+		memset((void *)&line[1], 'a' + i, lineLen[i]);
+		line[lineLen[i] + 1] = '\0';
+		trn.clkDiv = LCD_I2C_CLK_DIV;
+		trn.flags = I2C_TF_SG;
+		trn.segs = lineSegs;
+		begin();
+		run_wait(&trn);
+		sprintf(name, "lcd line [%u chars]", lineLen[i]);
+		report(name);
+		lineFrames[i] = frames_since_begin();
+		trn.flags = 0;
+	}
+	perChar = (lineFrames[1] - lineFrames[0]) / (lineLen[1] - lineLen[0]);
+	printf("  bus: %u bytes/char + %u a line\n", (unsigned)perChar,
+		   (unsigned)(lineFrames[0] - perChar * lineLen[0]));
+	check(perChar == LCD_BUS_BYTES_PER_CHAR, "encoding costs LCD_BUS_BYTES_PER_CHAR a character");
+	sim_hd44780_row(&exp.lcd, 0, LCD_COLS, row);
+	check(row[LCD_COLS - 1] == 'b', "long line shows on row 1");
+
+	trn.buf = buf;
+	begin();
+	lcd_clear_int(&trn);
+	run_wait(&trn);
+	report("lcd clear");
+	sim_hd44780_row(&exp.lcd, 1, 12, row);
+	check(strcmp(row, "            ") == 0, "lcd clear blanks the display");
+	sim_run(LCD_CLEAR_DELAY);
+
+	bench_layout();
+
+	blTrn.buf = blBuf;
+	lcd_set_backlight_int(1, &blTrn);
+	begin();
+	check(usi_i2c_post(&blTrn) == 0, "backlight write posted");
+	check(usi_i2c_post(&blTrn) != 0, "slot taken until the write is done");
+	while (!usi_i2c_check_post_event())
+		__bis_SR_register(gSysSleepMode | GIE);
+	usi_i2c_clear_post_event();
+	report("backlight [posted]");
+	check( (blTrn.status == I2C_TS_DONE) && !usi_i2c_post_pending(), "posted backlight write completes and frees the slot");
+	check(sim_mcp23008_pins(&exp) & 0x80, "backlight pin on");
+	check(exp.lcd.violations == 0, "no transfers while the lcd was busy");
+}
+
+// One RTC time read; the row it reports is the wait from the request to the job starting.
+static void* arb_rtc_job(i2c_transaction_t *t, void *userdata)
+{
+	static uint8_t state = 0;
+	(void)userdata;
+
+	if (state == 0)
+	{
+		if (arbName != NULL)
+			report(arbName);
+		arbRtcStarted = 1;
+		usi_i2c_get();
+		t->buf = buf;
+		t->callbackFn = arb_rtc_job;
+		ds3231m_get_time(t);
+		state = 1;
+		usi_i2c_txrx_start(t);
+	}
+	else
+	{
+		t->callbackFn = NULL;
+		t->transactType = I2C_T_IDLE;
+		usi_i2c_release();
+		arbReady &= ~(1 << ARB_RTC);
+		state = 0;
+	}
+	return NULL;
+}
+
+// Two LCD lines, like displayRtcDataSM(); gives way between them when arbYield is set.
+static void* arb_lcd_job(i2c_transaction_t *t, void *userdata)
+{
+	static uint8_t state = 0;
+	(void)userdata;
+
+	switch (state)
+	{
+	case 1:
+		t->flags = 0;
+		if (arbYield && i2c_arb_yield(arb_lcd_job))
+		{
+			arbParks++;
+			t->callbackFn = NULL;
+			t->transactType = I2C_T_IDLE;
+			usi_i2c_release();
+			break;
+		}
+		// fall through
+	case 0:
+		usi_i2c_get();
+		line[0] = 0x80 | ((state == 0) ? 0x00 : 0x40);
+		strcpy((char *)&line[1], (state == 0) ? "Arbiter  line 1" : "Arbiter  line 2");
+		t->address = IO_EXPANDER_ADDR;
+		t->clkDiv = LCD_I2C_CLK_DIV;
+		t->flags = I2C_TF_SG;
+		t->segs = lineSegs;
+		t->transactType = I2C_T_TX_STOP;
+		t->callbackFn = arb_lcd_job;
+		state++;
+		usi_i2c_txrx_start(t);
+		break;
+	default:
+		t->flags = 0;
+		t->callbackFn = NULL;
+		t->transactType = I2C_T_IDLE;
+		usi_i2c_release();
+		arbReady &= ~(1 << ARB_LCD);
+		state = 0;
+		break;
+	}
+	return NULL;
+}
+
+// A cut down main() loop: the LCD redraw starts first and the RTC asks for the bus during its first line.
+static void arb_run(uint8_t yield, const char *name)
+{
+	uint8_t client;
+
+	arbYield = yield;
+	arbName = name;
+	arbRtcStarted = 0;
+	arbReady = 1 << ARB_LCD;
+	while (arbReady || usi_i2c_busy())
+	{
+		if (usi_i2c_check_event())
+		{
+			usi_i2c_clear_event();
+			if (trn.callbackFn != NULL)
+				trn.callbackFn(&trn, NULL);
+		}
+		client = i2c_arb_dispatch(&trn, arbReady);
+		if (client == ARB_LCD && !(arbReady & (1 << ARB_RTC)) && !arbRtcStarted)
+		{
+			arbReady |= 1 << ARB_RTC;					// As if the 1 Hz interrupt had woken main().
+			begin();
+			i2c_arb_dispatch(&trn, arbReady);
+		}
+		if (usi_i2c_busy() && !usi_i2c_check_event())
+			__bis_SR_register(gSysSleepMode | GIE);
+	}
+}
+
+static void bench_arbiter(void)
+{
+	static const uint8_t t0[] = { 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01 };
+	char row[16];
+
+	memcpy(rtc.reg, t0, sizeof(t0));
+	arb_run(0, "arb rtc wait [no yield]");
+	check(arbParks == 0, "lcd job doesn't give way unless it yields");
+	arb_run(1, "arb rtc wait [yield]");
+	check(arbParks == 1, "lcd job gives way once between its lines");
+	check(memcmp((const uint8_t *)buf, t0, sizeof(t0)) == 0, "rtc job reads the time");
+	sim_hd44780_row(&exp.lcd, 0, 15, row);
+	check(strcmp(row, "Arbiter  line 1") == 0, "lcd job draws line 1");
+	sim_hd44780_row(&exp.lcd, 1, 15, row);
+	check(strcmp(row, "Arbiter  line 2") == 0, "parked lcd job resumes and draws line 2");
+	check(i2c_arb_owner() == I2C_ARB_NONE, "arbiter idle afterwards");
+}
+
+// Reset to the first screen [the time read and two lines drawn], the way main() used to do it: spin for the
+// LCD power on delay, then a blocking LCD init, then the RTC.
+static void boot_blocking(void)
+{
+	ds3231m_init(&trn, buf);
+	sim_run(600000);
+	if (lcd_check_io_expander_no_init_int(&trn, buf))
+		lcd_io_expander_init_int(&trn, buf);
+	lcd_init_int(&trn, buf);
+	trn.buf = buf;
+	lcd_set_backlight_int(1, &trn);
+	run_wait(&trn);
+	lcd_clear_int(&trn);
+	run_wait(&trn);
+	sim_run(LCD_CLEAR_DELAY);
+	rtc_read_time();
+	arbName = NULL;
+	arbYield = 0;
+	arbReady = 1 << ARB_LCD;
+	while (arbReady || usi_i2c_busy())
+	{
+		if (usi_i2c_check_event())
+		{
+			usi_i2c_clear_event();
+			if (trn.callbackFn != NULL)
+				trn.callbackFn(&trn, NULL);
+		}
+		i2c_arb_dispatch(&trn, arbReady);
+		if (usi_i2c_busy() && !usi_i2c_check_event())
+			__bis_SR_register(gSysSleepMode | GIE);
+	}
+}
+
+// The same with the timer driven LCD init; the RTC jobs use the bus during the LCD delays.
+static void boot_async(void)
+{
+	uint8_t ready;
+
+	lcd_init_async_start(LCD_POWER_ON_DELAY, buf);
+	ds3231m_init(&trn, buf);
+	arbName = NULL;
+	arbYield = 0;
+	arbReady = (1 << ARB_RTC) | (1 << ARB_LCD);
+	while (arbReady || usi_i2c_busy() || !lcd_initialised())
+	{
+		if (usi_i2c_check_event())
+		{
+			usi_i2c_clear_event();
+			if (trn.callbackFn != NULL)
+				trn.callbackFn(&trn, NULL);
+		}
+		ready = arbReady;
+		if (lcd_init_pending())
+			ready |= 1 << ARB_LCD_INIT;
+		if (!lcd_initialised())
+			ready &= ~(1 << ARB_LCD);
+		i2c_arb_dispatch(&trn, ready);
+		if (!usi_i2c_check_event() && (usi_i2c_busy() || (!lcd_initialised() && !lcd_init_pending())))
+			__bis_SR_register(gSysSleepMode | GIE);
+	}
+}
+
+static void bench_boot(void)
+{
+	char row[16];
+	sim_counters_t now;
+
+	memset(exp.lcd.ddram, ' ', sizeof(exp.lcd.ddram));
+	begin();
+	boot_blocking();
+	report("boot [blocking init]");
+	check(exp.lcd.violations == 0, "blocking init keeps to the lcd timing");
+
+	memset(exp.lcd.ddram, 'x', sizeof(exp.lcd.ddram));
+	exp.lcd.fourBit = 0;									// As if the lcd had just powered up.
+	exp.lcd.display = 0;
+	begin();
+	boot_async();
+	report("boot [async init]");
+	sim_get_counters(&now);
+	check(lcd_initialised(), "async init finishes");
+	check(exp.lcd.violations == 0, "async init keeps to the lcd timing");
+	check(exp.lcd.fourBit && (exp.lcd.display == 0x04), "async init leaves the lcd in 4-bit mode with the display on");
+	sim_hd44780_row(&exp.lcd, 1, 15, row);
+	check(strcmp(row, "Arbiter  line 2") == 0, "first screen drawn after the async init");
+	check(SIM_CYCLES_TO_US(now.sleepCycles - mark.sleepCycles) > 0.8 * SIM_CYCLES_TO_US(now.cycles - mark.cycles),
+		  "cpu asleep for most of the async boot");
+}
+
+// CCR1 times the LCD init, then belongs to the backlight PWM [as in main.c's TIMER0_A1 ISR].
+static int ccr1_tick(void)
+{
+	return (bl_pwm_active()) ? bl_pwm_tick() : lcd_init_tick();
+}
+
+// Steps the backlight fade on a simulated 1ms systick until it settles.
+static void bl_fade_wait(void)
+{
+	uint16_t ms;
+
+	for (ms = 0; ms < 2 * BL_FADE_STEP_MS * BL_LEVEL_MAX; ms++)
+	{
+		sim_run(SIM_SMCLK_HZ / 1000ul);
+		bl_tick();
+	}
+}
+
+static double out1_duty(void)
+{
+	sim_counters_t now;
+
+	sim_get_counters(&now);
+	return (double)(now.out1HighCycles - mark.out1HighCycles) / (double)(now.cycles - mark.cycles);
+}
+
+static void bench_backlight(void)
+{
+	uint8_t i;
+	double duty;
+
+	bl_init();
+	for (i = 0; (i < 100) && !bl_start(); i++)
+		sim_run(SIM_SMCLK_HZ / 1000ul);							// The last init delay may still be on CCR1.
+	check(bl_pwm_active(), "backlight takes CCR1 after the lcd init");
+
+	bl_fade_to(128);
+	bl_fade_wait();
+	begin();
+	sim_run(10ul * SIM_SMCLK_HZ / 1000ul);
+	report("backlight 50% [10ms]");
+	duty = out1_duty();
+	check( (bl_level() == 128) && (duty > 0.49) && (duty < 0.51), "backlight pwm duty follows the level");
+
+	bl_fade_to(BL_LEVEL_MAX);
+	bl_fade_wait();
+	begin();
+	sim_run(10ul * SIM_SMCLK_HZ / 1000ul);
+	report("backlight 100% [10ms]");
+	check( (timer_isrs_since_begin() == 0) && (out1_duty() > 0.99), "full backlight is steady with no interrupts");
+
+	bl_activity();
+	for (i = 0; i < BL_TIMEOUT_S; i++)
+		bl_second(12);
+	bl_fade_wait();
+	begin();
+	sim_run(10ul * SIM_SMCLK_HZ / 1000ul);
+	report("backlight off [10ms]");
+	check( bl_dark() && (timer_isrs_since_begin() == 0) && (out1_duty() == 0.0),
+		   "backlight fades out after the timeout and stays quiet");
+	check( bl_activity() && !bl_dark(), "input brings the backlight back");
+}
+
+static void bench_faults(void)
+{
+#if USI_I2C_WDT == 1
+	uint16_t i;
+#endif
+	begin();
+	sim_wedge_bus(&rtc.dev);
+	usi_i2c_bus_clear();
+	report("bus clear");
+	check( (P1IN & SIM_SDA_PIN) != 0, "bus clear frees SDA");
+
+	sim_wedge_bus(&rtc.dev);
+	begin();
+	rtc_read_time();
+	report("rtc get time [wedged]");
+	check(usi_i2c_get_error() == USI_I2C_ERR_NONE, "transaction clears a wedged bus and goes ahead");
+
+	usi_i2c_set_retry_policy(retryPolicy);
+	trn.address = NO_DEV_ADDR;
+	trn.clkDiv = I2C_CLK_DEFAULT;
+	trn.buf = buf;
+	buf[0] = 0;
+	trn.numBytes = 1;
+	trn.transactType = I2C_T_TX_STOP;
+	errCount = 0;
+	begin();
+	run_wait(&trn);
+	report("nack x3 [2 retries]");
+	check( (usi_i2c_get_error() == USI_I2C_ERR_NO_ACK_ON_ADDRESS) && (errCount == 1), "nack reported once after retries");
+
+#if USI_I2C_WDT == 1
+	errCount = 0;
+	sim_fault_scl_hold(5ul * SIM_SMCLK_HZ / 1000ul);
+	begin();
+	rtc_read_time();
+	report("scl held [timeout]");
+	check( (usi_i2c_get_error() == USI_I2C_ERR_TIMEOUT) && (errCount == 1) && (lastErr == USI_I2C_ERR_TIMEOUT),
+		   "held SCL times out");
+	sim_run(5ul * SIM_SMCLK_HZ / 1000ul);
+	rtc_read_time();
+	check(usi_i2c_get_error() == USI_I2C_ERR_NONE, "bus usable after the timeout");
+
+	usi_i2c_set_retry_policy(rtcRetryPolicy);
+	errCount = 0;
+	rtc.reg[RTC_SEC] = 0x07;
+	trn.buf = buf;
+	ds3231m_get_regs(&trn, RTC_SEC, 7);
+	usi_i2c_txrx_start(&trn);
+	for (i = 0; (i < 1000) && (buf[0] == RTC_SEC); i++)
+		sim_run(16);												// Until the read half has stored the first byte.
+	sim_fault_scl_hold(5ul * SIM_SMCLK_HZ / 1000ul);
+	usi_i2c_sleep_wait(1);
+	trn.transactType = I2C_T_IDLE;
+	check( (usi_i2c_get_error() == USI_I2C_ERR_NONE) && (errCount == 0) && (memcmp((const uint8_t *)buf, rtc.reg, 7) == 0),
+		   "random read retried after a timeout in the read half sends the register pointer again");
+	usi_i2c_set_retry_policy(retryPolicy);
+
+	errCount = 0;
+	sim_fault_scl_hold(50ul * SIM_SMCLK_HZ / 1000ul);
+	begin();
+	rtc_read_time();
+	report("scl held [clear stuck]");
+	check( (usi_i2c_get_error() == USI_I2C_ERR_TIMEOUT) && (errCount == 1) &&
+		   (sim_now() - mark.cycles < 4ul * USI_I2C_WDT_TICKS + 100), "a bus clear that can't clock gives up too");
+	sim_run(50ul * SIM_SMCLK_HZ / 1000ul);
+	rtc_read_time();
+	check(usi_i2c_get_error() == USI_I2C_ERR_NONE, "bus usable after the stuck clear");
+#endif
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_ds3231_init(&rtc);
+	sim_attach(&rtc.dev);
+	sim_mcp23008_init(&exp, IO_EXPANDER_ADDR);
+	sim_attach(&exp.dev);
+	sim_set_ccr_handler(1, ccr1_tick);
+#if USI_I2C_WDT == 1
+	sim_set_ccr_handler(2, usi_i2c_wdt_tick);
+#endif
+
+	usi_i2c_set_error_callback(i2c_error);
+	usi_i2c_master_init(USISSEL_2, USIDIV_5);
+
+	printf("%-22s %6s %6s %6s %6s %9s %9s %6s %6s\n", "operation", "isrs", "scl", "frames", "starts", "us", "sleep us",
+		   "wakes", "timer");
+	bench_rtc();
+	bench_timekeeping();
+	bench_lcd();
+	bench_arbiter();
+	bench_boot();
+	bench_backlight();
+	bench_faults();
+	check(exp.lcd.timingErrs == 0, "lcd setup, hold and pulse times kept throughout");
+
+	printf("\n%s: %d check(s) failed\n", (failures) ? "FAIL" : "PASS", failures);
+	return (failures) ? 1 : 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * msp430.h
+ *
+ * Host stand-in for the TI device header, used by the simulator build only [see usi_sim.c].
+ * Just the registers, bits and intrinsics that the I2C driver, the LCD and RTC libraries use.
+ *
+ * The USI, P1 I2C pin and Timer_A0 count registers go through sim_reg8()/sim_reg16() so that the
+ * simulator sees every access and can work out what the driver has just done to the bus.
+ */
+
+#ifndef SIM_MSP430_H_
+#define SIM_MSP430_H_
+
+#include <stdint.h>
+
+#define __MSP430G2452__
+
+// Register file.
+typedef struct _sim_regs_t
+{
+	uint8_t		usictl0;
+	uint8_t		usictl1;
+	uint8_t		usickctl;
+	uint8_t		usicnt;
+	uint8_t		usisrl;
+	uint8_t		usisrh;
+	uint8_t		p1in;
+	uint8_t		p1out;
+	uint8_t		p1dir;
+	uint8_t		p1sel;
+	uint8_t		p1sel2;
+	uint8_t		p1ren;
+	uint16_t	ta0ctl;
+	uint16_t	ta0r;
+	uint16_t	ta0cctl0;
+	uint16_t	ta0cctl1;
+	uint16_t	ta0cctl2;
+	uint16_t	ta0ccr0;
+	uint16_t	ta0ccr1;
+	uint16_t	ta0ccr2;
+	uint16_t	ta0iv;
+} sim_regs_t;
+
+extern sim_regs_t sim_regs;
+
+volatile uint8_t *sim_reg8(volatile uint8_t *reg);
+volatile uint16_t *sim_reg16(volatile uint16_t *reg);
+
+#define USICTL0				(*sim_reg8(&sim_regs.usictl0))
+#define USICTL1				(*sim_reg8(&sim_regs.usictl1))
+#define USICKCTL			(*sim_reg8(&sim_regs.usickctl))
+#define USICNT				(*sim_reg8(&sim_regs.usicnt))
+#define USISRL				(*sim_reg8(&sim_regs.usisrl))
+#define USISRH				(*sim_reg8(&sim_regs.usisrh))
+#define P1IN				(*sim_reg8(&sim_regs.p1in))
+#define P1OUT				(*sim_reg8(&sim_regs.p1out))
+#define P1DIR				(*sim_reg8(&sim_regs.p1dir))
+#define P1SEL				(*sim_reg8(&sim_regs.p1sel))
+#define P1SEL2				(*sim_reg8(&sim_regs.p1sel2))
+#define P1REN				(*sim_reg8(&sim_regs.p1ren))
+#define TA0CTL				(*sim_reg16(&sim_regs.ta0ctl))
+#define TA0R				(*sim_reg16(&sim_regs.ta0r))
+#define TA0CCTL0			(*sim_reg16(&sim_regs.ta0cctl0))
+#define TA0CCTL1			(*sim_reg16(&sim_regs.ta0cctl1))
+#define TA0CCTL2			(*sim_reg16(&sim_regs.ta0cctl2))
+#define TA0CCR0				(*sim_reg16(&sim_regs.ta0ccr0))
+#define TA0CCR1				(*sim_reg16(&sim_regs.ta0ccr1))
+#define TA0CCR2				(*sim_reg16(&sim_regs.ta0ccr2))
+#define TA0IV				(*sim_reg16(&sim_regs.ta0iv))
+
+// USICTL0
+#define USIPE7				0x80
+#define USIPE6				0x40
+#define USIPE5				0x20
+#define USILSB				0x10
+#define USIMST				0x08
+#define USIGE				0x04
+#define USIOE				0x02
+#define USISWRST			0x01
+// USICTL1
+#define USICKPH				0x80
+#define USII2C				0x40
+#define USISTTIE			0x20
+#define USIIE				0x10
+#define USIAL				0x08
+#define USISTP				0x04
+#define USISTTIFG			0x02
+#define USIIFG				0x01
+// USICKCTL
+#define USIDIV_0			0x00
+#define USIDIV_1			0x20
+#define USIDIV_2			0x40
+#define USIDIV_3			0x60
+#define USIDIV_4			0x80
+#define USIDIV_5			0xa0
+#define USIDIV_6			0xc0
+#define USIDIV_7			0xe0
+#define USISSEL_0			0x00
+#define USISSEL_1			0x04
+#define USISSEL_2			0x08
+#define USISSEL_3			0x0c
+#define USICKPL				0x02
+#define USISWCLK			0x01
+// USICNT
+#define USISCLREL			0x80
+#define USI16B				0x40
+#define USIIFGCC			0x20
+
+// Timer_A
+#define TASSEL_1			0x0100
+#define TASSEL_2			0x0200
+#define MC_0				0x0000
+#define MC_1				0x0010
+#define MC_2				0x0020
+#define TACLR				0x0004
+#define TAIE				0x0002
+#define TAIFG				0x0001
+#define CCIE				0x0010
+#define CCIFG				0x0001
+#define OUT					0x0004
+#define OUTMOD_0			0x0000
+#define OUTMOD_4			0x0080
+#define TA0IV_NONE			0
+#define TA0IV_TACCR1		2
+#define TA0IV_TACCR2		4
+#define TA0IV_TAIFG			10
+
+// Status register.
+#define GIE					0x0008
+#define CPUOFF				0x0010
+#define LPM0_bits			(CPUOFF)
+#define LPM3_bits			0x00d0
+#define LPM4_bits			0x00f0
+
+#define BIT0				0x01
+#define BIT1				0x02
+#define BIT2				0x04
+#define BIT3				0x08
+#define BIT4				0x10
+#define BIT5				0x20
+#define BIT6				0x40
+#define BIT7				0x80
+
+// Intrinsics.
+void sim_sleep(uint16_t sr);
+void sim_wake_on_exit(uint16_t sr);
+uint16_t sim_get_interrupt_state(void);
+void sim_set_interrupt_state(uint16_t state);
+void sim_delay_cycles(uint32_t cycles);
+
+#define __interrupt
+#define __even_in_range(x, y)			(x)
+#define __bis_SR_register(x)			sim_sleep(x)
+#define __bic_SR_register_on_exit(x)	sim_wake_on_exit(x)
+#define __get_interrupt_state()			sim_get_interrupt_state()
+#define __set_interrupt_state(x)		sim_set_interrupt_state(x)
+#define __disable_interrupt()			sim_set_interrupt_state(0)
+#define __enable_interrupt()			sim_set_interrupt_state(GIE)
+#define __delay_cycles(x)				sim_delay_cycles(x)
+#define __no_operation()
+
+#endif /* SIM_MSP430_H_ */
@@ -0,0 +1,111 @@
+/*
+ * sim.h
+ *
+ * Host simulator for the USI I2C master driver.
+ * usi_sim.c models the USI in I2C master mode, the bus and the slave side of the protocol;
+ * sim_ds3231.c and sim_mcp23008.c are the devices that hang off the bus.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <msp430.h>
+
+#define SIM_SMCLK_HZ			16000000ul
+#define SIM_ISR_CYCLES			60		// Charged per interrupt taken; rough average for the driver's states [see the ISR header].
+#define SIM_SDA_PIN				BIT7
+#define SIM_SCL_PIN				BIT6
+#define SIM_MAX_DEVS			4
+#define SIM_STALL_CYCLES		(10ull * SIM_SMCLK_HZ)	// A sleep that isn't woken within this is a driver hang.
+
+#define SIM_CYCLES_TO_US(c)		((double)(c) * 1e6 / SIM_SMCLK_HZ)
+
+// Everything the simulator counts.  Take differences around an operation.
+typedef struct _sim_counters_t
+{
+	uint64_t			cycles;			// Simulated SMCLK cycles.
+	uint64_t			sleepCycles;	// Cycles main() spent in low power mode [interrupts included].
+	uint32_t			isrs;			// USI interrupts taken.
+	uint32_t			timerIsrs;		// Timer_A0 CCR1 and CCR2 interrupts taken.
+	uint32_t			wakeups;		// __bic_SR_register_on_exit() calls.
+	uint32_t			sclClocks;		// SCL rising edges.
+	uint32_t			frames;			// 9 bit byte + ack frames on the bus.
+	uint32_t			starts;			// Start conditions, including repeated starts.
+	uint32_t			stops;
+	uint64_t			out1HighCycles;	// Cycles the TA0.1 output was high; OUTMOD_0 levels are only seen when the counters are read.
+} sim_counters_t;
+
+// A slave device.  Embed as the first member of the device model.
+typedef struct _sim_i2c_dev_t sim_i2c_dev_t;
+struct _sim_i2c_dev_t
+{
+	uint8_t				address;		// 8 bit write address.
+	void				(*start)(sim_i2c_dev_t *dev, uint8_t read);	// Addressed after a [repeated] start.
+	int					(*write)(sim_i2c_dev_t *dev, uint8_t data);	// Returns 1 to ACK.
+	uint8_t				(*read)(sim_i2c_dev_t *dev);
+	void				(*stop)(sim_i2c_dev_t *dev);
+};
+
+// Simulator control.
+void sim_reset(void);
+void sim_attach(sim_i2c_dev_t *dev);
+void sim_set_ccr_handler(int ccr, int (*handler)(void));
+void sim_run(uint64_t cycles);
+uint64_t sim_now(void);
+void sim_get_counters(sim_counters_t *pCounters);
+
+// Fault injection.
+void sim_fault_scl_hold(uint64_t cycles);
+void sim_wedge_bus(sim_i2c_dev_t *dev);
+
+// DS3231M model.
+typedef struct _sim_ds3231_t
+{
+	sim_i2c_dev_t		dev;
+	uint8_t				reg[19];
+	uint8_t				ptr;
+	uint8_t				first;			// Next written byte is the register pointer.
+} sim_ds3231_t;
+
+void sim_ds3231_init(sim_ds3231_t *rtc);
+void sim_ds3231_tick(sim_ds3231_t *rtc, uint16_t seconds);
+
+// HD44780 model [behind the expander].
+typedef struct _sim_hd44780_t
+{
+	uint8_t				ddram[128];
+	uint8_t				cgram[64];
+	uint8_t				ac;				// Address counter.
+	uint8_t				cgMode;			// 1: data goes to CGRAM.
+	uint8_t				fourBit;
+	uint8_t				haveHigh;		// Upper nibble of a 4-bit transfer received.
+	uint8_t				high;
+	uint8_t				display;		// Display control bits [D, C, B].
+	uint8_t				lastCtrl;		// R/W, RS, E as on the backpack.
+	uint8_t				lastData;		// DB7-0.
+	uint64_t			eRise;
+	uint64_t			busyUntil;
+	uint32_t			cmds;
+	uint32_t			chars;
+	uint32_t			violations;		// Transfers made while the controller was still busy.
+	uint32_t			timingErrs;		// E edges that broke a setup, hold or pulse width time.
+} sim_hd44780_t;
+
+// MCP23008 model.
+typedef struct _sim_mcp23008_t
+{
+	sim_i2c_dev_t		dev;
+	uint8_t				reg[11];
+	uint8_t				ptr;
+	uint8_t				first;
+	uint8_t				pinsIn;			// Levels driven onto input pins from outside.
+	uint32_t			gpioWrites;
+	sim_hd44780_t		lcd;
+} sim_mcp23008_t;
+
+void sim_mcp23008_init(sim_mcp23008_t *exp, uint8_t address);
+uint8_t sim_mcp23008_pins(sim_mcp23008_t *exp);
+void sim_hd44780_row(sim_hd44780_t *lcd, uint8_t row, uint8_t cols, char *out);
+
+#endif /* SIM_H_ */
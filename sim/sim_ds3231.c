@@ -0,0 +1,102 @@
+/*
+ * sim_ds3231.c
+ *
+ * DS3231M model: 19 registers behind an auto-incrementing pointer that wraps from 0x12 back to 0.
+ * The first byte written after the address sets the pointer.  Time is only advanced by sim_ds3231_tick().
+ */
+
+#include <string.h>
+#include "sim.h"
+
+#define DS_NUM_REGS		19
+#define DS_TEMP_MSB		0x11
+#define DS_TEMP_LSB		0x12
+
+static void ds_start(sim_i2c_dev_t *dev, uint8_t read)
+{
+	sim_ds3231_t *rtc = (sim_ds3231_t *)dev;
+
+	rtc->first = (read == 0);
+}
+
+static int ds_write(sim_i2c_dev_t *dev, uint8_t data)
+{
+	sim_ds3231_t *rtc = (sim_ds3231_t *)dev;
+
+	if (rtc->first)
+	{
+		rtc->first = 0;
+		rtc->ptr = (data < DS_NUM_REGS) ? data : 0;
+		return 1;
+	}
+	if ( (rtc->ptr != DS_TEMP_MSB) && (rtc->ptr != DS_TEMP_LSB) )	// Temperature is read only.
+		rtc->reg[rtc->ptr] = data;
+	rtc->ptr = (rtc->ptr + 1) % DS_NUM_REGS;
+	return 1;
+}
+
+static uint8_t ds_read(sim_i2c_dev_t *dev)
+{
+	sim_ds3231_t *rtc = (sim_ds3231_t *)dev;
+	uint8_t data = rtc->reg[rtc->ptr];
+
+	rtc->ptr = (rtc->ptr + 1) % DS_NUM_REGS;
+	return data;
+}
+
+void sim_ds3231_init(sim_ds3231_t *rtc)
+{
+	memset(rtc, 0, sizeof(*rtc));
+	rtc->dev.address = 0xd0;
+	rtc->dev.start = ds_start;
+	rtc->dev.write = ds_write;
+	rtc->dev.read = ds_read;
+	rtc->reg[0x0e] = 0x1c;				// Power on control and status.
+	rtc->reg[0x0f] = 0x88;
+	rtc->reg[DS_TEMP_MSB] = 0x19;		// 25.0C
+}
+
+static uint8_t bcd_inc(uint8_t *reg, uint8_t mask, uint8_t first, uint8_t last)
+{
+	uint8_t val = *reg & mask;
+
+	val = (val & 0x0f) == 9 ? (val & 0xf0) + 0x10 : val + 1;
+	if (val > last)
+	{
+		*reg = (*reg & ~mask) | first;
+		return 1;
+	}
+	*reg = (*reg & ~mask) | val;
+	return 0;
+}
+
+static uint8_t days_in_month(uint8_t monthBcd, uint8_t yearBcd)
+{
+	static const uint8_t days[] = { 0x31, 0x28, 0x31, 0x30, 0x31, 0x30, 0x31, 0x31, 0x30, 0x31, 0x30, 0x31 };
+	uint8_t month = (monthBcd >> 4) * 10 + (monthBcd & 0x0f);
+	uint8_t year = (yearBcd >> 4) * 10 + (yearBcd & 0x0f);
+
+	if ( (month == 2) && ((year & 0x03) == 0) )
+		return 0x29;
+	return days[(month - 1) % 12];
+}
+
+// Advance the clock [24 hour mode only].
+void sim_ds3231_tick(sim_ds3231_t *rtc, uint16_t seconds)
+{
+	uint8_t *r = rtc->reg;
+
+	while (seconds--)
+	{
+		if ( !bcd_inc(&r[0], 0x7f, 0x00, 0x59) ||
+			 !bcd_inc(&r[1], 0x7f, 0x00, 0x59) ||
+			 !bcd_inc(&r[2], 0x3f, 0x00, 0x23) )
+			continue;
+		bcd_inc(&r[3], 0x07, 0x01, 0x07);
+		if ( !bcd_inc(&r[4], 0x3f, 0x01, days_in_month(r[5] & 0x1f, r[6])) ||
+			 !bcd_inc(&r[5], 0x1f, 0x01, 0x12) )
+			continue;
+		if (bcd_inc(&r[6], 0xff, 0x00, 0x99))
+			r[5] ^= 0x80;				// Century.
+	}
+}
@@ -0,0 +1,206 @@
+/*
+ * sim_mcp23008.c
+ *
+ * MCP23008 port expander model with an HD44780 hung off it, wired as the Adafruit backpack [see lcd.h].
+ * The expander has sequential addressing unless IOCON.SEQOP is set.  The HD44780 latches on the falling
+ * edge of E; it starts in 8-bit mode and only honours the commands the firmware uses.
+ *
+ * The HD44780 timing is checked too: all outputs change together at the end of a written byte, so RS or R/W
+ * changing in the write that raises E breaks the address setup time, and RS, R/W or the data changing in the
+ * write that drops E breaks the hold times.  E high and E cycle times are checked against the simulated clock.
+ */
+
+#include <string.h>
+#include "sim.h"
+
+#define MCP_IODIR		0x00
+#define MCP_IOCON		0x05
+#define MCP_GPIO		0x09
+#define MCP_OLAT		0x0a
+#define MCP_NUM_REGS	11
+#define MCP_SEQOP		0x20
+
+#define LCD_E			0x04
+#define LCD_RS			0x02
+#define LCD_RW			0x01
+
+#define HD_CMD_CYCLES	((uint64_t)37 * SIM_SMCLK_HZ / 1000000ul)		// 37us
+#define HD_CLR_CYCLES	((uint64_t)1520 * SIM_SMCLK_HZ / 1000000ul)		// 1.52ms
+#define HD_PW_EH_CYCLES	((uint64_t)450 * SIM_SMCLK_HZ / 1000000000ul)	// 450ns E high [Vcc 2.7-4.5V].
+#define HD_CYC_E_CYCLES	((uint64_t)1000 * SIM_SMCLK_HZ / 1000000000ul)	// 1000ns E cycle.
+
+static void hd_byte(sim_hd44780_t *lcd, uint8_t data, uint8_t rs)
+{
+	uint64_t now = sim_now();
+
+	if (now < lcd->busyUntil)
+		lcd->violations++;
+	lcd->busyUntil = now + HD_CMD_CYCLES;
+
+	if (rs)
+	{
+		lcd->chars++;
+		if (lcd->cgMode)
+		{
+			lcd->cgram[lcd->ac & 0x3f] = data;
+			lcd->ac = (lcd->ac + 1) & 0x3f;
+		}
+		else
+		{
+			lcd->ddram[lcd->ac & 0x7f] = data;
+			lcd->ac = (lcd->ac + 1) & 0x7f;
+		}
+		return;
+	}
+
+	lcd->cmds++;
+	if (data & 0x80)
+	{
+		lcd->ac = data & 0x7f;
+		lcd->cgMode = 0;
+	}
+	else if (data & 0x40)
+	{
+		lcd->ac = data & 0x3f;
+		lcd->cgMode = 1;
+	}
+	else if (data & 0x20)
+		lcd->fourBit = (data & 0x10) == 0;
+	else if (data & 0x08)
+		lcd->display = data & 0x07;
+	else if (data & 0x0c)
+		return;											// Cursor shift and entry mode; the firmware only uses the defaults.
+	else if (data & 0x02)
+	{
+		lcd->ac = 0;
+		lcd->cgMode = 0;
+		lcd->busyUntil = now + HD_CLR_CYCLES;
+	}
+	else if (data & 0x01)
+	{
+		memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+		lcd->ac = 0;
+		lcd->cgMode = 0;
+		lcd->busyUntil = now + HD_CLR_CYCLES;
+	}
+}
+
+// New levels on the HD44780 pins: ctrl = R/W, RS, E as on the backpack, data = DB7-0.
+static void hd_pins(sim_hd44780_t *lcd, uint8_t ctrl, uint8_t data)
+{
+	uint8_t rs = (lcd->lastCtrl & LCD_RS) != 0;
+	uint8_t rise = !(lcd->lastCtrl & LCD_E) && (ctrl & LCD_E);
+	uint8_t fall = (lcd->lastCtrl & LCD_E) && !(ctrl & LCD_E);
+	uint64_t now = sim_now();
+
+	if ( (rise && ((ctrl ^ lcd->lastCtrl) & (LCD_RS | LCD_RW))) ||							// tAS
+		 (rise && (now - lcd->eRise < HD_CYC_E_CYCLES)) ||
+		 (fall && ((ctrl ^ lcd->lastCtrl) & (LCD_RS | LCD_RW))) ||							// tAH
+		 (fall && !(ctrl & LCD_RW) && (data != lcd->lastData)) ||							// tH
+		 (fall && (now - lcd->eRise < HD_PW_EH_CYCLES)) )
+		lcd->timingErrs++;
+	if (rise)
+		lcd->eRise = now;
+
+	if (fall)												// Latch on E falling.
+	{
+		if (!lcd->fourBit)
+			hd_byte(lcd, lcd->lastData, rs);
+		else if (!lcd->haveHigh)
+		{
+			lcd->high = lcd->lastData >> 4;
+			lcd->haveHigh = 1;
+		}
+		else
+		{
+			lcd->haveHigh = 0;
+			hd_byte(lcd, (lcd->high << 4) | (lcd->lastData >> 4), rs);
+		}
+	}
+	lcd->lastCtrl = ctrl;
+	lcd->lastData = data;
+}
+
+uint8_t sim_mcp23008_pins(sim_mcp23008_t *exp)
+{
+	// Outputs show OLAT, inputs whatever is driving them [pulled up].
+	return (exp->reg[MCP_OLAT] & ~exp->reg[MCP_IODIR]) | (exp->pinsIn & exp->reg[MCP_IODIR]);
+}
+
+static void mcp_pins_to_lcd(sim_mcp23008_t *exp)
+{
+	uint8_t pins = sim_mcp23008_pins(exp);
+
+	hd_pins(&exp->lcd, pins & 0x07, ((pins >> 3) & 0x0f) << 4);	// DB3-0 aren't wired.
+}
+
+static void mcp_start(sim_i2c_dev_t *dev, uint8_t read)
+{
+	sim_mcp23008_t *exp = (sim_mcp23008_t *)dev;
+
+	exp->first = (read == 0);
+}
+
+static void mcp_next(sim_mcp23008_t *exp)
+{
+	if ( (exp->reg[MCP_IOCON] & MCP_SEQOP) == 0 )
+		exp->ptr = (exp->ptr + 1) % MCP_NUM_REGS;
+}
+
+static int mcp_write(sim_i2c_dev_t *dev, uint8_t data)
+{
+	sim_mcp23008_t *exp = (sim_mcp23008_t *)dev;
+
+	if (exp->first)
+	{
+		exp->first = 0;
+		exp->ptr = data % MCP_NUM_REGS;
+		return 1;
+	}
+	if ( (exp->ptr == MCP_GPIO) || (exp->ptr == MCP_OLAT) )
+	{
+		exp->gpioWrites++;
+		exp->reg[MCP_OLAT] = data;
+	}
+	else
+		exp->reg[exp->ptr] = data;
+	mcp_pins_to_lcd(exp);
+	mcp_next(exp);
+	return 1;
+}
+
+static uint8_t mcp_read(sim_i2c_dev_t *dev)
+{
+	sim_mcp23008_t *exp = (sim_mcp23008_t *)dev;
+	uint8_t data;
+
+	data = (exp->ptr == MCP_GPIO) ? sim_mcp23008_pins(exp) : exp->reg[exp->ptr];
+	mcp_next(exp);
+	return data;
+}
+
+void sim_mcp23008_init(sim_mcp23008_t *exp, uint8_t address)
+{
+	memset(exp, 0, sizeof(*exp));
+	exp->dev.address = address;
+	exp->dev.start = mcp_start;
+	exp->dev.write = mcp_write;
+	exp->dev.read = mcp_read;
+	exp->reg[MCP_IODIR] = 0xff;
+	exp->pinsIn = 0xff;
+	memset(exp->lcd.ddram, ' ', sizeof(exp->lcd.ddram));
+}
+
+// Copy out what's shown on one row; out must hold cols + 1.
+void sim_hd44780_row(sim_hd44780_t *lcd, uint8_t row, uint8_t cols, char *out)
+{
+	static const uint8_t rowStart[] = { 0x00, 0x40, 0x14, 0x54 };
+	uint8_t i, c;
+
+	for (i = 0; i < cols; i++)
+	{
+		c = lcd->ddram[(rowStart[row & 0x03] + i) & 0x7f];
+		out[i] = (c < 0x20 || c > 0x7e) ? '?' : (char)c;
+	}
+	out[cols] = '\0';
+}
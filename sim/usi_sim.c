@@ -0,0 +1,627 @@
+/*
+ * usi_sim.c
+ *
+ * USI [I2C master mode] and bus model for running the driver on a host.
+ *
+ * Every driver access to a USI, P1 or Timer_A0 register goes through sim_reg8()/sim_reg16() [see msp430.h].
+ * Each access first syncs the model with whatever the previous access changed, so register writes take
+ * effect in program order even though they're plain stores.
+ *
+ * Model:
+ * - Writing a non-zero count to USICNT clears USIIFG and starts shifting, one bit per 2^USIDIV SMCLK cycles:
+ *   SCL falls, the output latch takes the MSB of USISRL, SCL rises and USISRL shifts left taking SDA in at bit 0.
+ *   USIIFG is set once the count runs out, with SCL left high.  Releasing USISWRST with a zero count sets USIIFG.
+ * - With USIGE set the latch is transparent and USIOE takes effect at once; that's how the driver makes starts
+ *   and stops.  Otherwise a USIOE change takes effect at the next falling edge of SCL.
+ * - SDA and SCL are open drain: low if anything pulls them low.  With USIPE6/7 clear the pins follow P1DIR/P1OUT.
+ * - An interrupt costs SIM_ISR_CYCLES; register changes made by the ISR land half way through.
+ * - Slaves don't stretch SCL unless told to [sim_fault_scl_hold()].
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+// The driver's interrupt service routine.
+void USI_TXRX(void);
+
+typedef enum
+{
+	SL_IDLE		= 0,
+	SL_ADDR		= 1,
+	SL_WRITE	= 2,
+	SL_ACK		= 3,		// Slave is driving an ACK.
+	SL_READ		= 4,
+	SL_MACK		= 5,		// Master's ACK/NACK clock.
+	SL_IGNORE	= 6			// Not addressed or NACKed; wait for a start or stop.
+} sim_slave_state_t;
+
+sim_regs_t sim_regs;
+
+static sim_counters_t		sim_cnt;
+static sim_i2c_dev_t		*sim_devs[SIM_MAX_DEVS];
+static uint8_t				sim_num_devs;
+static int					(*sim_ccr_handler[3])(void);	// CCR1 and CCR2; CCR0 [the systick] isn't modelled.
+
+static struct
+{
+	uint64_t				now;
+	uint16_t				gie;
+	uint8_t					inIsr;
+	uint8_t					inEngine;
+	uint8_t					wake;
+	// USI.
+	uint8_t					latch;
+	uint8_t					oe;
+	uint8_t					sclUsi;
+	uint8_t					bitPhase;		// 0: idle, 1: falling edge due, 2: rising edge due, 3: end of bit due.
+	uint64_t				bitDue;
+	uint8_t					cntPrev;
+	uint8_t					swrstPrev;
+	// Bus.
+	uint8_t					scl;
+	uint8_t					sda;
+	uint64_t				sclHoldUntil;
+	// TA0.1 output.
+	uint8_t					out1;
+	uint64_t				out1Since;
+	// Timer_A0: CCR matches after ccrFrom[n] are still to be served [CCIFG].
+	uint64_t				ccrFrom[3];
+} sim;
+
+static struct
+{
+	sim_slave_state_t		state;
+	sim_i2c_dev_t			*dev;
+	uint8_t					shreg;
+	uint8_t					bits;
+	uint8_t					byteDone;
+	uint8_t					ack;
+	uint8_t					read;
+	uint8_t					sda;
+} sl;
+
+// #########################
+// Slave side of the protocol.
+static sim_i2c_dev_t* find_dev(uint8_t address)
+{
+	uint8_t i;
+
+	for (i = 0; i < sim_num_devs; i++)
+		if (sim_devs[i]->address == address)
+			return sim_devs[i];
+	return NULL;
+}
+
+static void slave_start(void)
+{
+	sim_cnt.starts++;
+	sl.state = SL_ADDR;
+	sl.bits = 0;
+	sl.byteDone = 0;
+	sl.sda = 1;
+}
+
+static void slave_stop(void)
+{
+	sim_cnt.stops++;
+	if ( (sl.dev != NULL) && (sl.dev->stop != NULL) )
+		sl.dev->stop(sl.dev);
+	sl.dev = NULL;
+	sl.state = SL_IDLE;
+	sl.sda = 1;
+}
+
+static void slave_load_read(void)
+{
+	sl.shreg = sl.dev->read(sl.dev);
+	sl.bits = 0;
+	sl.state = SL_READ;
+	sl.sda = sl.shreg >> 7;
+}
+
+static void slave_rising(uint8_t sda)
+{
+	switch (sl.state)
+	{
+	case SL_ADDR:
+	case SL_WRITE:
+		sl.shreg = (sl.shreg << 1) | sda;
+		if (++sl.bits < 8)
+			break;
+		sl.byteDone = 1;
+		sim_cnt.frames++;
+		if (sl.state == SL_ADDR)
+		{
+			sl.dev = find_dev(sl.shreg & 0xfe);
+			sl.ack = (sl.dev != NULL);
+			sl.read = sl.shreg & 0x01;
+			if ( (sl.dev != NULL) && (sl.dev->start != NULL) )
+				sl.dev->start(sl.dev, sl.read);
+		}
+		else
+			sl.ack = sl.dev->write(sl.dev, sl.shreg);
+		break;
+
+	case SL_READ:
+		sl.bits++;
+		break;
+
+	case SL_MACK:
+		sl.ack = (sda == 0);
+		sim_cnt.frames++;
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void slave_falling(void)
+{
+	switch (sl.state)
+	{
+	case SL_ADDR:
+	case SL_WRITE:
+		if (sl.byteDone)
+		{
+			sl.byteDone = 0;
+			sl.sda = (sl.ack) ? 0 : 1;
+			sl.state = (sl.ack) ? SL_ACK : SL_IGNORE;
+		}
+		break;
+
+	case SL_ACK:
+		sl.sda = 1;
+		if (sl.read)
+			slave_load_read();
+		else
+		{
+			sl.bits = 0;
+			sl.state = SL_WRITE;
+		}
+		break;
+
+	case SL_READ:
+		if (sl.bits == 8)
+		{
+			sl.sda = 1;
+			sl.state = SL_MACK;
+		}
+		else
+			sl.sda = (sl.shreg >> (7 - sl.bits)) & 0x01;
+		break;
+
+	case SL_MACK:
+		if (sl.ack)
+			slave_load_read();
+		else
+		{
+			sl.sda = 1;
+			sl.state = SL_IGNORE;
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+// #########################
+// Bus.
+static int usi_owns_pins(void)
+{
+	return ( ((sim_regs.usictl0 & (USIPE7 | USIPE6)) == (USIPE7 | USIPE6)) && !(sim_regs.usictl0 & USISWRST) );
+}
+
+static uint8_t gpio_level(uint8_t pin)
+{
+	return ( !(sim_regs.p1dir & pin) || (sim_regs.p1out & pin) ) ? 1 : 0;
+}
+
+static uint8_t master_scl(void)
+{
+	if (usi_owns_pins())
+		return sim.sclUsi;
+	return (sim_regs.usictl0 & USIPE6) ? 1 : gpio_level(SIM_SCL_PIN);
+}
+
+static uint8_t master_sda(void)
+{
+	if (usi_owns_pins())
+		return (sim.oe) ? sim.latch : 1;
+	return (sim_regs.usictl0 & USIPE7) ? 1 : gpio_level(SIM_SDA_PIN);
+}
+
+// Settle the bus lines and hand any edges or start/stop conditions to the slave side.
+static void bus_update(void)
+{
+	uint8_t scl, sda;
+
+	scl = master_scl() & (sim.now >= sim.sclHoldUntil);
+	if (scl != sim.scl)
+	{
+		sim.scl = scl;
+		if (scl)
+		{
+			sim_cnt.sclClocks++;
+			slave_rising(sim.sda);
+		}
+		else
+			slave_falling();
+	}
+
+	sda = master_sda() & sl.sda;
+	if (sda != sim.sda)
+	{
+		sim.sda = sda;
+		if (sim.scl)
+		{
+			if (sda)
+				slave_stop();
+			else
+				slave_start();
+		}
+	}
+}
+
+// #########################
+// USI.
+static void usi_sync(void)
+{
+	uint8_t ctl0 = sim_regs.usictl0;
+	uint8_t cnt = sim_regs.usicnt & 0x1f;
+
+	if (ctl0 & USISWRST)
+	{
+		sim_regs.usicnt &= 0xe0;					// Reset clears the bit counter.
+		cnt = 0;
+		sim.bitPhase = 0;
+		sim.sclUsi = 1;
+		sim.oe = 0;
+	}
+	else
+	{
+		if (sim.swrstPrev && (cnt == 0))
+			sim_regs.usictl1 |= USIIFG;
+		if (ctl0 & USIGE)
+		{
+			sim.latch = sim_regs.usisrl >> 7;
+			sim.oe = (ctl0 & USIOE) != 0;
+		}
+		if ( cnt && (sim.cntPrev == 0) && (sim.bitPhase == 0) )
+		{
+			sim_regs.usictl1 &= ~USIIFG;
+			sim.bitPhase = 1;
+			sim.bitDue = sim.now;
+		}
+	}
+	sim.swrstPrev = ctl0 & USISWRST;
+	sim.cntPrev = cnt;
+	bus_update();
+}
+
+static uint32_t half_bit_cycles(void)
+{
+	uint32_t period = 1ul << ((sim_regs.usickctl >> 5) & 0x07);
+
+	return (period < 2) ? 1 : (period >> 1);
+}
+
+static void bit_event(void)
+{
+	switch (sim.bitPhase)
+	{
+	case 1:		// Falling edge; next bit out.
+		sim.sclUsi = 0;
+		sim.oe = (sim_regs.usictl0 & USIOE) != 0;
+		sim.latch = sim_regs.usisrl >> 7;
+		bus_update();
+		sim.bitPhase = 2;
+		sim.bitDue += half_bit_cycles();
+		break;
+
+	case 2:		// Rising edge; bit in.
+		if (sim.now < sim.sclHoldUntil)
+		{
+			sim.bitDue = sim.sclHoldUntil;			// A slave is stretching the clock.
+			break;
+		}
+		sim.sclUsi = 1;
+		bus_update();
+		sim_regs.usisrl = (sim_regs.usisrl << 1) | sim.sda;
+		sim.bitPhase = 3;
+		sim.bitDue += half_bit_cycles();
+		break;
+
+	case 3:		// End of bit.
+		sim_regs.usicnt = (sim_regs.usicnt & 0xe0) | ((sim_regs.usicnt - 1) & 0x1f);
+		sim.cntPrev = sim_regs.usicnt & 0x1f;
+		if (sim.cntPrev == 0)
+		{
+			sim_regs.usictl1 |= USIIFG;
+			sim.bitPhase = 0;
+		}
+		else
+			sim.bitPhase = 1;
+		break;
+
+	default:
+		break;
+	}
+}
+
+static int usi_isr_pending(void)
+{
+	return ( (sim.gie & GIE) && !sim.inIsr &&
+			 ((sim_regs.usictl1 & (USIIE | USIIFG)) == (USIIE | USIIFG)) );
+}
+
+static void run_usi_isr(void)
+{
+	uint64_t entry = sim.now;
+
+	sim_cnt.isrs++;
+	sim.now = entry + (SIM_ISR_CYCLES / 2);
+	sim.inIsr = 1;
+	USI_TXRX();
+	usi_sync();
+	sim.inIsr = 0;
+	if (sim.now < entry + SIM_ISR_CYCLES)			// Anything spinning in the ISR takes longer.
+		sim.now = entry + SIM_ISR_CYCLES;
+}
+
+static int ccr_armed(int n)
+{
+	uint16_t cctl = (n == 1) ? sim_regs.ta0cctl1 : sim_regs.ta0cctl2;
+
+	return ( (sim.gie & GIE) && !sim.inIsr && (sim_ccr_handler[n] != NULL) && (cctl & CCIE) );
+}
+
+static uint64_t ccr_due(int n)
+{
+	uint64_t from = sim.ccrFrom[n];
+	uint16_t delta = ((n == 1) ? sim_regs.ta0ccr1 : sim_regs.ta0ccr2) - (uint16_t)from;
+
+	return from + ((delta == 0) ? 0x10000ull : delta);
+}
+
+// A match while the interrupt can't be taken [GIE off, in another ISR] stays pending, as CCIFG does, and is
+// served late; the hardware output still toggled on time.
+static void ccr_track(void)
+{
+	int n;
+	uint16_t cctl;
+
+	for (n = 1; n <= 2; n++)
+	{
+		cctl = (n == 1) ? sim_regs.ta0cctl1 : sim_regs.ta0cctl2;
+		if ( !(cctl & CCIE) || (ccr_due(n) > sim.now) )
+			sim.ccrFrom[n] = sim.now;
+	}
+}
+
+// TA0.1 output level; toggle mode [OUTMOD_4] flips it on each CCR1 match, otherwise it follows the OUT bit.
+static void out1_update(int match, uint64_t when)
+{
+	uint8_t level = sim.out1;
+
+	if ((sim_regs.ta0cctl1 & 0x00e0) == OUTMOD_4)
+		level ^= (match != 0);
+	else if ((sim_regs.ta0cctl1 & 0x00e0) == OUTMOD_0)
+		level = (sim_regs.ta0cctl1 & OUT) != 0;
+	if (sim.out1)
+		sim_cnt.out1HighCycles += when - sim.out1Since;
+	sim.out1Since = when;
+	sim.out1 = level;
+}
+
+static void run_ccr_isr(int n, uint64_t match)
+{
+	uint64_t entry = sim.now;
+
+	if (n == 1)
+		out1_update(1, match);
+	sim.ccrFrom[n] = entry;							// CCIFG clears; the next match is against whatever CCR the handler leaves.
+
+	sim_cnt.timerIsrs++;
+	sim.inIsr = 1;
+	if (sim_ccr_handler[n]())
+		sim_wake_on_exit(LPM0_bits);
+	usi_sync();
+	sim.inIsr = 0;
+	if (sim.now < entry + SIM_ISR_CYCLES)
+		sim.now = entry + SIM_ISR_CYCLES;
+}
+
+// Run the hardware until 'limit', or until an ISR wakes main() if untilWake.
+static void engine_run(uint64_t limit, int untilWake)
+{
+	uint64_t next, t, match;
+	int which, n;
+	uint8_t nested = sim.inEngine;
+
+	sim.inEngine = 1;
+	for (;;)
+	{
+		usi_sync();
+		if (untilWake && sim.wake)
+			break;
+		if (usi_isr_pending())
+		{
+			run_usi_isr();
+			continue;
+		}
+
+		ccr_track();
+		next = UINT64_MAX;
+		which = 0;
+		if (sim.bitPhase)
+		{
+			next = (sim.bitDue < sim.now) ? sim.now : sim.bitDue;
+			which = 1;
+		}
+		for (n = 1; n <= 2; n++)
+		{
+			if (ccr_armed(n) && ((t = ccr_due(n)) < next))
+			{
+				next = t;
+				which = 1 + n;
+			}
+		}
+		match = next;
+		if (next < sim.now)
+			next = sim.now;
+		if ( (sim.sclHoldUntil > sim.now) && (sim.sclHoldUntil < next) )
+		{
+			next = sim.sclHoldUntil;
+			which = 4;
+		}
+		if (next > limit)
+		{
+			if (limit != UINT64_MAX)
+				sim.now = limit;
+			ccr_track();							// Nothing was due before the limit.
+			break;
+		}
+
+		sim.now = next;
+		if (which == 1)
+			bit_event();
+		else if (which <= 3)
+			run_ccr_isr(which - 1, match);
+		else
+			bus_update();
+	}
+	sim.inEngine = nested;
+}
+
+// #########################
+// Register access hooks and intrinsics [see msp430.h].
+volatile uint8_t *sim_reg8(volatile uint8_t *reg)
+{
+	usi_sync();
+	if ( !sim.inEngine && !sim.inIsr && usi_isr_pending() )
+	{
+		sim.inEngine = 1;							// Main has just let an interrupt in; take it now.
+		while (usi_isr_pending())
+			run_usi_isr();
+		sim.inEngine = 0;
+	}
+	if (reg == &sim_regs.p1in)
+		sim_regs.p1in = (sim_regs.p1in & ~(SIM_SCL_PIN | SIM_SDA_PIN)) |
+						((sim.scl) ? SIM_SCL_PIN : 0) | ((sim.sda) ? SIM_SDA_PIN : 0);
+	return reg;
+}
+
+volatile uint16_t *sim_reg16(volatile uint16_t *reg)
+{
+	if (reg == &sim_regs.ta0r)
+		sim_regs.ta0r = (uint16_t)sim.now;
+	return reg;
+}
+
+void sim_sleep(uint16_t sr)
+{
+	uint64_t entry = sim.now;
+
+	sim.gie |= sr & GIE;
+	sim.wake = 0;
+	engine_run(sim.now + SIM_STALL_CYCLES, 1);
+	sim_cnt.sleepCycles += sim.now - entry;
+	if (!sim.wake)
+	{
+		fprintf(stderr, "sim: nothing woke the CPU for %llu cycles; driver hung.\n", (unsigned long long)SIM_STALL_CYCLES);
+		exit(2);
+	}
+}
+
+void sim_wake_on_exit(uint16_t sr)
+{
+	(void)sr;
+	sim.wake = 1;
+	sim_cnt.wakeups++;
+}
+
+uint16_t sim_get_interrupt_state(void)
+{
+	return sim.gie;
+}
+
+void sim_set_interrupt_state(uint16_t state)
+{
+	sim.gie = state & GIE;
+}
+
+void sim_delay_cycles(uint32_t cycles)
+{
+	engine_run(sim.now + cycles, 0);
+}
+
+// #########################
+// Control.
+void sim_reset(void)
+{
+	memset(&sim_regs, 0, sizeof(sim_regs));
+	memset(&sim, 0, sizeof(sim));
+	memset(&sl, 0, sizeof(sl));
+	memset(&sim_cnt, 0, sizeof(sim_cnt));
+	sim.sclUsi = 1;
+	sim.latch = 1;
+	sim.scl = 1;
+	sim.sda = 1;
+	sl.sda = 1;
+	sim_regs.p1in = SIM_SCL_PIN | SIM_SDA_PIN;
+}
+
+void sim_attach(sim_i2c_dev_t *dev)
+{
+	if (sim_num_devs < SIM_MAX_DEVS)
+		sim_devs[sim_num_devs++] = dev;
+}
+
+// Called for Timer_A0 CCR1 or CCR2 matches [the firmware's TIMER0_A1 ISR]; returns non-zero to wake main().
+void sim_set_ccr_handler(int ccr, int (*handler)(void))
+{
+	if ( (ccr == 1) || (ccr == 2) )
+		sim_ccr_handler[ccr] = handler;
+}
+
+// Let the hardware run with main() busy elsewhere [not sleeping].
+void sim_run(uint64_t cycles)
+{
+	engine_run(sim.now + cycles, 0);
+}
+
+uint64_t sim_now(void)
+{
+	return sim.now;
+}
+
+void sim_get_counters(sim_counters_t *pCounters)
+{
+	out1_update(0, sim.now);
+	*pCounters = sim_cnt;
+	pCounters->cycles = sim.now;
+}
+
+// Slaves hold SCL low for this long from now.
+void sim_fault_scl_hold(uint64_t cycles)
+{
+	sim.sclHoldUntil = sim.now + cycles;
+	bus_update();
+}
+
+// Leave 'dev' part way through sending a 0x00 byte, holding SDA low; as if the master was reset mid-read.
+void sim_wedge_bus(sim_i2c_dev_t *dev)
+{
+	sl.dev = dev;
+	sl.read = 1;
+	sl.shreg = 0x00;
+	sl.bits = 0;
+	sl.state = SL_READ;
+	sl.sda = 0;
+	sim.sda = 0;									// Not a start; the slave has been holding SDA all along.
+	bus_update();
+}
@@ -6,6 +6,15 @@
  */
 #include "ui_update.h"
 
+// Lower and upper bound of each DateTime_t field, by its offset from seconds.
+static const uint8_t field_bounds[][2] = {	{ 0, 59 },		// seconds
+											{ 0, 59 },		// minutes
+											{ 0, 23 },		// hours
+											{ 1, 7 },		// dow
+											{ 1, 31 },		// dom
+											{ 1, 12 },		// month
+											{ 0, 99 } };	// year
+
 static uint8_t change_param(uint8_t param, int8_t dir, const uint8_t lbound, const uint8_t ubound)
 {
 	if (param > lbound && param < ubound)
@@ -23,13 +32,23 @@ static uint8_t change_param(uint8_t param, int8_t dir, const uint8_t lbound, con
 	return 0xff;	// something went wrong.
 }
 
+/*
+ * Steps the field at 'offset' [offsetof(DateTime_t, ...)] within its bounds, wrapping at either end.
+ */
+uint8_t change_field(DateTime_t *dt, uint8_t offset, int8_t dir)
+{
+	uint8_t *field = &dt->seconds + offset;
+
+	*field = change_param(*field, dir, field_bounds[offset][0], field_bounds[offset][1]);
+	return *field;
+}
+
 /*
  * 1=Sunday, 7=Saturday
  */
 uint8_t change_day_of_week(DateTime_t *dt, int8_t dir)
 {
-	dt->dow = change_param(dt->dow, dir, 1, 7);
-	return dt->dow;
+	return change_field(dt, offsetof(DateTime_t, dow), dir);
 }
 
 /*
@@ -37,36 +56,30 @@ uint8_t change_day_of_week(DateTime_t *dt, int8_t dir)
  */
 uint8_t change_day_of_month(DateTime_t *dt, int8_t dir)
 {
-	dt->dom = change_param(dt->dom, dir, 1, 31);
-	return dt->dom;
+	return change_field(dt, offsetof(DateTime_t, dom), dir);
 }
 
 uint8_t change_year(DateTime_t *dt, int8_t dir)
 {
-	dt->year = change_param(dt->year, dir, 0, 99);
-	return dt->year;
+	return change_field(dt, offsetof(DateTime_t, year), dir);
 }
 
 uint8_t change_month(DateTime_t *dt, int8_t dir)
 {
-	dt->month = change_param(dt->month, dir, 1, 12);
-	return dt->month;
+	return change_field(dt, offsetof(DateTime_t, month), dir);
 }
 
 uint8_t change_hour(DateTime_t *dt, int8_t dir)
 {
-	dt->hours = change_param(dt->hours, dir, 0, 23);
-	return dt->hours;
+	return change_field(dt, offsetof(DateTime_t, hours), dir);
 }
 
 uint8_t change_minute(DateTime_t *dt, int8_t dir)
 {
-	dt->minutes = change_param(dt->minutes, dir, 0, 59);
-	return dt->minutes;
+	return change_field(dt, offsetof(DateTime_t, minutes), dir);
 }
 
 uint8_t change_second(DateTime_t *dt, int8_t dir)
 {
-	dt->seconds = change_param(dt->seconds, dir, 0, 59);
-	return dt->seconds;
+	return change_field(dt, offsetof(DateTime_t, seconds), dir);
 }
@@ -10,10 +10,12 @@
 
 #include <msp430.h>
 #include <stdint.h>
+#include <stddef.h>
 #include "datetime.h"
 
 
 /* Provided functions: */
+uint8_t change_field(DateTime_t *dt, uint8_t offset, int8_t dir);
 uint8_t change_day_of_week(DateTime_t *dt, int8_t dir);
 uint8_t change_day_of_month(DateTime_t *dt, int8_t dir);
 uint8_t change_year(DateTime_t *dt, int8_t dir);